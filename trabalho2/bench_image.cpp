@@ -0,0 +1,406 @@
+#include "image_codec.h"
+#include "pnm_io.h"
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+// GICL configurations that are benchmarked (all lossless).
+struct GiclMode {
+    const char* name;
+    CodingMode mode;
+    bool online_k;
+};
+
+static const GiclMode GICL_MODES[] = {
+    { "med",         CodingMode::BLOCK_MED,    false },
+    { "med-k",       CodingMode::BLOCK_MED,    true  },
+    { "select",      CodingMode::BLOCK_SELECT, false },
+    { "select-k",    CodingMode::BLOCK_SELECT, true  },
+    { "context",     CodingMode::CONTEXT,      false },
+    { "progressive", CodingMode::PROGRESSIVE,  false },
+    { "wavelet",     CodingMode::WAVELET,      false },
+    { "weighted",    CodingMode::WEIGHTED,     false },
+    { "quadtree",    CodingMode::QUADTREE,     false },
+};
+
+static const int PNG_LEVELS[] = { 1, 6, 9 };
+
+// Outcome of one measured step, run in its own process so that the peak
+// RSS reported by wait4 belongs to that step alone.
+struct Measurement {
+    double seconds = 0.0;
+    long peak_rss_kb = 0;
+    bool ok = false;
+};
+
+struct Row {
+    std::string image;
+    int width = 0;
+    int height = 0;
+    std::string codec;
+    int level = 0;
+    size_t raw_bytes = 0;
+    size_t compressed_bytes = 0;
+    Measurement enc;
+    Measurement dec;
+    bool lossless = false;
+};
+
+// Loads a PNM (or .pnm.gz) the way the GICL encoder sees it: as grayscale.
+static Image load_gray(const std::string& path) {
+    if (is_gzip_path(path)) {
+        GzPnmReader reader(path, true);
+        reader.wait_rows(reader.image().rows);
+        return reader.image();
+    }
+    return read_pnm(path, true);
+}
+
+static cv::Mat as_mat(const Image& img) {
+    int type = img.wide() ? CV_16UC1 : CV_8UC1;
+    return cv::Mat(img.rows, img.cols, type, const_cast<uint8_t*>(img.data()), img.row_bytes());
+}
+
+static bool same_pixels(const Image& a, const Image& b) {
+    if (a.rows != b.rows || a.cols != b.cols || a.bytes_per_sample() != b.bytes_per_sample()) {
+        return false;
+    }
+    for (int r = 0; r < a.rows; ++r) {
+        if (std::memcmp(a.ptr<uint8_t>(r), b.ptr<uint8_t>(r), a.row_bytes()) != 0) return false;
+    }
+    return true;
+}
+
+// Runs 'step' in a child process. The child times the step itself and
+// sends the elapsed seconds back through a pipe; its output is discarded.
+template <typename Step>
+static Measurement run_isolated(Step step) {
+    Measurement result;
+    int fds[2];
+    if (pipe(fds) != 0) {
+        throw std::runtime_error("pipe() failed.");
+    }
+    std::cout.flush();
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        throw std::runtime_error("fork() failed.");
+    }
+    if (pid == 0) {
+        ::close(fds[0]);
+        int null_fd = ::open("/dev/null", O_WRONLY);
+        if (null_fd >= 0) {
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+        }
+        int status = 0;
+        try {
+            auto start = std::chrono::steady_clock::now();
+            step();
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (write(fds[1], &seconds, sizeof(seconds)) != static_cast<ssize_t>(sizeof(seconds))) status = 1;
+        } catch (...) {
+            status = 1;
+        }
+        ::close(fds[1]);
+        _exit(status);
+    }
+
+    ::close(fds[1]);
+    double seconds = 0.0;
+    bool got_time = read(fds[0], &seconds, sizeof(seconds)) == static_cast<ssize_t>(sizeof(seconds));
+    ::close(fds[0]);
+
+    int status = 0;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        throw std::runtime_error("wait4() failed.");
+    }
+    result.ok = got_time && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    result.seconds = seconds;
+    result.peak_rss_kb = usage.ru_maxrss;
+    return result;
+}
+
+// Keeps the fastest run and the largest peak RSS over the repetitions.
+template <typename Step>
+static Measurement measure(Step step, int repeats) {
+    Measurement best;
+    for (int i = 0; i < repeats; ++i) {
+        Measurement m = run_isolated(step);
+        if (!m.ok) return m;
+        best.seconds = (i == 0) ? m.seconds : std::min(best.seconds, m.seconds);
+        best.peak_rss_kb = std::max(best.peak_rss_kb, m.peak_rss_kb);
+        best.ok = true;
+    }
+    return best;
+}
+
+static size_t file_size(const std::string& path) {
+    std::error_code ec;
+    auto size = fs::file_size(path, ec);
+    return ec ? 0 : static_cast<size_t>(size);
+}
+
+static void bench_gicl(const std::string& path, const Image& ref, const fs::path& work, int repeats,
+                       std::vector<Row>& rows) {
+    const std::string gicl = (work / "bench.gicl").string();
+    const std::string decoded = (work / "bench.pgm").string();
+
+    for (const GiclMode& mode : GICL_MODES) {
+        Row row;
+        row.codec = std::string("gicl-") + mode.name;
+        row.enc = measure([&] {
+            ImageCodec codec(path, gicl, -1, true, mode.mode, 0, mode.online_k);
+            codec.encode();
+        }, repeats);
+        if (row.enc.ok) {
+            row.compressed_bytes = file_size(gicl);
+            row.dec = measure([&] {
+                ImageCodec codec(gicl, decoded, 1, 1);
+                codec.decode();
+            }, repeats);
+            row.lossless = row.dec.ok && same_pixels(ref, read_pnm(decoded));
+        }
+        rows.push_back(row);
+    }
+    fs::remove(gicl);
+    fs::remove(decoded);
+}
+
+// The PNG steps mirror the GICL ones: encoding starts from the PNM file and
+// decoding ends with a PGM written to disk.
+static void bench_png(const std::string& path, const Image& ref, const fs::path& work, int repeats,
+                      std::vector<Row>& rows) {
+    const std::string png = (work / "bench.png").string();
+    const std::string decoded = (work / "bench.pgm").string();
+
+    for (int level : PNG_LEVELS) {
+        Row row;
+        row.codec = "png";
+        row.level = level;
+        row.enc = measure([&] {
+            Image img = load_gray(path);
+            std::vector<uchar> buf;
+            if (!cv::imencode(".png", as_mat(img), buf, { cv::IMWRITE_PNG_COMPRESSION, level })) {
+                throw std::runtime_error("PNG encoding failed.");
+            }
+            std::ofstream(png, std::ios::binary).write(reinterpret_cast<const char*>(buf.data()), buf.size());
+        }, repeats);
+        if (row.enc.ok) {
+            row.compressed_bytes = file_size(png);
+            row.dec = measure([&] {
+                std::ifstream in(png, std::ios::binary);
+                std::vector<uchar> buf((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+                cv::Mat img = cv::imdecode(buf, cv::IMREAD_UNCHANGED);
+                if (img.empty() || !cv::imwrite(decoded, img)) {
+                    throw std::runtime_error("PNG decoding failed.");
+                }
+            }, repeats);
+            row.lossless = row.dec.ok && same_pixels(ref, read_pnm(decoded));
+        }
+        rows.push_back(row);
+    }
+    fs::remove(png);
+    fs::remove(decoded);
+}
+
+static bool is_pnm_path(const fs::path& p) {
+    std::string name = p.filename().string();
+    for (const char* ext : { ".ppm", ".pgm", ".ppm.gz", ".pgm.gz" }) {
+        size_t n = std::strlen(ext);
+        if (name.size() > n && name.compare(name.size() - n, n, ext) == 0) return true;
+    }
+    return false;
+}
+
+static std::vector<std::string> collect_images(const std::vector<std::string>& dirs) {
+    std::vector<std::string> images;
+    for (const std::string& dir : dirs) {
+        if (fs::is_regular_file(dir)) {
+            images.push_back(dir);
+            continue;
+        }
+        if (!fs::is_directory(dir)) {
+            throw std::runtime_error("No such file or directory: " + dir);
+        }
+        for (const auto& entry : fs::recursive_directory_iterator(dir)) {
+            if (entry.is_regular_file() && is_pnm_path(entry.path())) {
+                images.push_back(entry.path().string());
+            }
+        }
+    }
+    std::sort(images.begin(), images.end());
+    return images;
+}
+
+static double mps(const Row& row, const Measurement& m) {
+    if (!m.ok || m.seconds <= 0.0) return 0.0;
+    return static_cast<double>(row.width) * row.height / 1e6 / m.seconds;
+}
+
+static double bpp(const Row& row) {
+    return 8.0 * row.compressed_bytes / (static_cast<double>(row.width) * row.height);
+}
+
+static void write_csv(const std::string& path, const std::vector<Row>& rows) {
+    std::ofstream out(path);
+    if (!out) {
+        throw std::runtime_error("Could not open report: " + path);
+    }
+    out << "image,width,height,codec,level,raw_bytes,compressed_bytes,bpp,"
+        << "encode_mps,decode_mps,encode_peak_rss_kb,decode_peak_rss_kb,lossless\n";
+    out << std::fixed;
+    for (const Row& row : rows) {
+        out << row.image << ',' << row.width << ',' << row.height << ',' << row.codec << ','
+            << row.level << ',' << row.raw_bytes << ',' << row.compressed_bytes << ','
+            << std::setprecision(4) << bpp(row) << ','
+            << std::setprecision(2) << mps(row, row.enc) << ',' << mps(row, row.dec) << ','
+            << row.enc.peak_rss_kb << ',' << row.dec.peak_rss_kb << ','
+            << (row.lossless ? 1 : 0) << '\n';
+    }
+}
+
+// Averages per codec over all images (bpp weighted by pixel count).
+static void print_summary(const std::vector<Row>& rows) {
+    struct Totals {
+        double pixels = 0, bits = 0, enc_s = 0, dec_s = 0;
+        long enc_rss = 0, dec_rss = 0;
+        int failures = 0;
+    };
+    std::vector<std::string> order;
+    std::map<std::string, Totals> totals;
+    for (const Row& row : rows) {
+        std::string key = row.codec;
+        if (row.level > 0) key += '-' + std::to_string(row.level);
+        if (!totals.count(key)) order.push_back(key);
+        Totals& t = totals[key];
+        if (!row.lossless) {
+            t.failures++;
+            continue;
+        }
+        t.pixels += static_cast<double>(row.width) * row.height;
+        t.bits += 8.0 * row.compressed_bytes;
+        t.enc_s += row.enc.seconds;
+        t.dec_s += row.dec.seconds;
+        t.enc_rss = std::max(t.enc_rss, row.enc.peak_rss_kb);
+        t.dec_rss = std::max(t.dec_rss, row.dec.peak_rss_kb);
+    }
+
+    std::cout << std::left << std::setw(18) << "codec" << std::right << std::setw(8) << "bpp"
+              << std::setw(10) << "enc MP/s" << std::setw(10) << "dec MP/s"
+              << std::setw(12) << "enc RSS KB" << std::setw(12) << "dec RSS KB" << "\n";
+    std::cout << std::fixed;
+    for (const std::string& key : order) {
+        const Totals& t = totals.at(key);
+        std::cout << std::left << std::setw(18) << key << std::right;
+        if (t.pixels == 0) {
+            std::cout << "  (failed)\n";
+            continue;
+        }
+        std::cout << std::setprecision(3) << std::setw(8) << t.bits / t.pixels
+                  << std::setprecision(2) << std::setw(10) << t.pixels / 1e6 / t.enc_s
+                  << std::setw(10) << t.pixels / 1e6 / t.dec_s
+                  << std::setw(12) << t.enc_rss << std::setw(12) << t.dec_rss;
+        if (t.failures > 0) std::cout << "  (" << t.failures << " failed)";
+        std::cout << "\n";
+    }
+}
+
+void print_usage() {
+    std::cerr << "Usage: bench_image [options] [image or directory ...]\n\n"
+              << "Encodes and decodes every PGM/PPM (also .gz) found, as grayscale, with each\n"
+              << "lossless GICL mode and with OpenCV PNG at compression levels 1, 6 and 9.\n"
+              << "Each step runs in its own process to measure its peak RSS.\n"
+              << "(Default input: images, which includes images/kodak)\n\n"
+              << "Options:\n"
+              << "  -o <report.csv>  CSV report (default: bench_image.csv)\n"
+              << "  -n <repeats>     Runs per step; the fastest is kept (default: 3)\n"
+              << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    std::string report = "bench_image.csv";
+    int repeats = 3;
+    std::vector<std::string> inputs;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc) {
+            report = argv[++i];
+        } else if (arg == "-n" && i + 1 < argc) {
+            repeats = std::stoi(argv[++i]);
+        } else if (arg == "-h" || arg == "--help" || arg[0] == '-') {
+            print_usage();
+            return 1;
+        } else {
+            inputs.push_back(arg);
+        }
+    }
+    if (inputs.empty()) inputs.push_back("images");
+    if (repeats < 1) {
+        std::cerr << "Error: The number of runs must be at least 1.\n";
+        return 1;
+    }
+
+    try {
+        std::vector<std::string> images = collect_images(inputs);
+        if (images.empty()) {
+            std::cerr << "Error: No PGM/PPM images found.\n";
+            return 1;
+        }
+
+        fs::path work = fs::temp_directory_path() / ("bench_image." + std::to_string(getpid()));
+        fs::create_directories(work);
+
+        std::vector<Row> rows;
+        for (size_t i = 0; i < images.size(); ++i) {
+            const std::string& path = images[i];
+            Image ref = load_gray(path);
+            std::cout << "[" << i + 1 << "/" << images.size() << "] " << path << " ("
+                      << ref.cols << "x" << ref.rows << ")" << std::endl;
+
+            size_t first = rows.size();
+            bench_gicl(path, ref, work, repeats, rows);
+            bench_png(path, ref, work, repeats, rows);
+            for (size_t r = first; r < rows.size(); ++r) {
+                rows[r].image = path;
+                rows[r].width = ref.cols;
+                rows[r].height = ref.rows;
+                rows[r].raw_bytes = ref.row_bytes() * ref.rows;
+                if (!rows[r].lossless) {
+                    std::cerr << "Warning: " << rows[r].codec << " failed or was not lossless on "
+                              << path << "\n";
+                }
+            }
+        }
+        fs::remove_all(work);
+
+        write_csv(report, rows);
+        std::cout << "\n";
+        print_summary(rows);
+        std::cout << "\nReport written to " << report << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "An error occurred: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,66 @@
+#include "binary_coder.h"
+
+static const uint32_t TOP_VALUE = 1u << 24;
+static const int MOVE_BITS = 5;
+
+void BinaryEncoder::shift_low() {
+    if (static_cast<uint32_t>(m_low) < 0xFF000000u || (m_low >> 32) != 0) {
+        uint8_t carry = static_cast<uint8_t>(m_low >> 32);
+        uint8_t temp = m_cache;
+        do {
+            m_bs.write_n_bits(static_cast<uint8_t>(temp + carry), 8);
+            temp = 0xFF;
+        } while (--m_cache_size != 0);
+        m_cache = static_cast<uint8_t>(m_low >> 24);
+    }
+    m_cache_size++;
+    m_low = (m_low & 0x00FFFFFF) << 8;
+}
+
+void BinaryEncoder::encode(int bit, uint16_t& prob) {
+    uint32_t bound = (m_range >> BINARY_PROB_BITS) * prob;
+    if (bit == 0) {
+        m_range = bound;
+        prob += ((1 << BINARY_PROB_BITS) - prob) >> MOVE_BITS;
+    } else {
+        m_low += bound;
+        m_range -= bound;
+        prob -= prob >> MOVE_BITS;
+    }
+    while (m_range < TOP_VALUE) {
+        m_range <<= 8;
+        shift_low();
+    }
+}
+
+void BinaryEncoder::finish() {
+    for (int i = 0; i < 5; ++i) {
+        shift_low();
+    }
+}
+
+BinaryDecoder::BinaryDecoder(BitStream& bs) : m_bs(bs) {
+    for (int i = 0; i < 5; ++i) {
+        m_code = (m_code << 8) | static_cast<uint32_t>(m_bs.read_n_bits(8) & 0xFF);
+    }
+}
+
+int BinaryDecoder::decode(uint16_t& prob) {
+    uint32_t bound = (m_range >> BINARY_PROB_BITS) * prob;
+    int bit;
+    if (m_code < bound) {
+        m_range = bound;
+        prob += ((1 << BINARY_PROB_BITS) - prob) >> MOVE_BITS;
+        bit = 0;
+    } else {
+        m_code -= bound;
+        m_range -= bound;
+        prob -= prob >> MOVE_BITS;
+        bit = 1;
+    }
+    while (m_range < TOP_VALUE) {
+        m_range <<= 8;
+        m_code = (m_code << 8) | static_cast<uint32_t>(m_bs.read_n_bits(8) & 0xFF);
+    }
+    return bit;
+}
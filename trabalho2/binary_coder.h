@@ -0,0 +1,41 @@
+#ifndef BINARY_CODER_H
+#define BINARY_CODER_H
+
+#include "bit_stream.h"
+#include <cstdint>
+
+// Adaptive binary range coder (LZMA style). Each context owns an 11-bit
+// probability of the symbol being 0, updated after every coded bit.
+class BinaryEncoder {
+public:
+    explicit BinaryEncoder(BitStream& bs) : m_bs(bs) {}
+
+    void encode(int bit, uint16_t& prob);
+    void finish();
+
+private:
+    void shift_low();
+
+    BitStream& m_bs;
+    uint64_t m_low = 0;
+    uint32_t m_range = 0xFFFFFFFF;
+    uint8_t m_cache = 0;
+    uint64_t m_cache_size = 1;
+};
+
+class BinaryDecoder {
+public:
+    explicit BinaryDecoder(BitStream& bs);
+
+    int decode(uint16_t& prob);
+
+private:
+    BitStream& m_bs;
+    uint32_t m_code = 0;
+    uint32_t m_range = 0xFFFFFFFF;
+};
+
+const int BINARY_PROB_BITS = 11;
+const uint16_t BINARY_PROB_INIT = 1 << (BINARY_PROB_BITS - 1);
+
+#endif
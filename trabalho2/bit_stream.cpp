@@ -16,6 +16,7 @@
 //
 //-------------------------------------------------------------------------------------------
 
+#include <algorithm>
 #include <cstdint>
 #include <fstream>
 #include <string>
@@ -33,22 +34,26 @@ BitStream::BitStream(fstream& fs, bool rw_status) : m_rw_status { rw_status },
 	}
 }
 
-int BitStream::read_bit() {
-	if(--m_bit_ptr < 0) {
-		if((m_buf = m_byte_stream.get()) == EOF)
-			return EOF;
-
-		m_bit_ptr = 7;
-	}
-
-	return (m_buf & (0x01 << m_bit_ptr)) >> m_bit_ptr;
-}
-
+//
+// Same bits as n calls of read_bit(), taking as many as are left in the
+// current byte per step; m_bit_ptr counts the bits not yet read from m_buf.
+//
 uint64_t BitStream::read_n_bits(int n) {
 	uint64_t x { };
-	for(int i = 0 ; i < n ; ++i) {
-		x <<= 1;
-		x |= read_bit();
+	while(n > 0) {
+		if(m_bit_ptr <= 0) {
+			if((m_buf = m_byte_stream.get()) == EOF) {
+				m_bit_ptr = 0;
+				return ~uint64_t { }; // What OR-ing in EOF bit by bit gave
+			}
+
+			m_bit_ptr = 8;
+		}
+
+		int take = min(m_bit_ptr, n);
+		m_bit_ptr -= take;
+		n -= take;
+		x = (x << take) | ((m_buf >> m_bit_ptr) & ((0x01 << take) - 1));
 	}
 
 	return x;
@@ -64,19 +69,23 @@ string BitStream::read_string() {
 	return s;
 }
 
-void BitStream::write_bit(int bit) {
-	if(m_bit_ptr < 0) {
-		m_byte_stream.put(m_buf);
-		m_bit_ptr = 7;
-		m_buf = 0;
-	}
-
-	m_buf |= (bit & 0x01) << m_bit_ptr--;
-}
-
+//
+// Same bits as n calls of write_bit(), filling what is left of the current
+// byte per step; m_bit_ptr is the position of the next bit in m_buf.
+//
 void BitStream::write_n_bits(uint64_t bits, int n) {
-	for(int i = n - 1 ; i >= 0 ; i--)
-		write_bit(((0x01 << i) & bits) >> i);
+	while(n > 0) {
+		if(m_bit_ptr < 0) {
+			m_byte_stream.put(m_buf);
+			m_bit_ptr = 7;
+			m_buf = 0;
+		}
+
+		int take = min(m_bit_ptr + 1, n);
+		n -= take;
+		m_buf |= static_cast<int>((bits >> n) & ((0x01u << take) - 1)) << (m_bit_ptr + 1 - take);
+		m_bit_ptr -= take;
+	}
 }
 
 void BitStream::write_string(const string& s) {
@@ -86,6 +95,16 @@ void BitStream::write_string(const string& s) {
 	write_n_bits('\n', 8); // Mark the end of the string with a newline
 }
 
+void BitStream::align() {
+	if(m_rw_status) {
+		m_bit_ptr = 0; // The next read_bit fetches a new byte
+	} else if(m_bit_ptr != 7) {
+		m_byte_stream.put(m_buf);
+		m_bit_ptr = 7;
+		m_buf = 0;
+	}
+}
+
 off_t BitStream::tell() {
 	return m_byte_stream.tell();
 }
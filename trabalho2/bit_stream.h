@@ -40,14 +40,37 @@ class BitStream {
 	BitStream& operator=(const BitStream&) = delete;
 
 	int read_bit();
-	uint64_t read_n_bits(int n);
+	uint64_t read_n_bits(int n); // Whole bytes at a time where it can
 	std::string read_string();
 	void write_bit(int bit);
-	void write_n_bits(uint64_t bits, int n);
+	void write_n_bits(uint64_t bits, int n); // Whole bytes at a time where it can
 	void write_string(const std::string& s);
+	void align(); // Moves to the next byte boundary (pads with zeros when writing)
 	off_t tell();
 	void close();
 };
 
-#endif
+// Single bits are inline: the entropy coders read and write most of their
+// bits one at a time, so a call per bit would cost more than the bit.
+inline int BitStream::read_bit() {
+	if(--m_bit_ptr < 0) {
+		if((m_buf = m_byte_stream.get()) == EOF)
+			return EOF;
+
+		m_bit_ptr = 7;
+	}
+
+	return (m_buf & (0x01 << m_bit_ptr)) >> m_bit_ptr;
+}
 
+inline void BitStream::write_bit(int bit) {
+	if(m_bit_ptr < 0) {
+		m_byte_stream.put(m_buf);
+		m_bit_ptr = 7;
+		m_buf = 0;
+	}
+
+	m_buf |= (bit & 0x01) << m_bit_ptr--;
+}
+
+#endif
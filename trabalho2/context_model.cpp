@@ -0,0 +1,187 @@
+#include "context_model.h"
+#include <algorithm>
+#include <cstdlib>
+
+const int ContextModel::J[32] = {
+    0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+    4, 4, 5, 5, 6, 6, 7, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+
+static int bits_for(int n) {
+    int bits = 0;
+    while ((1 << bits) < n) bits++;
+    return bits;
+}
+
+ContextModel::ContextModel(int maxval, int near)
+    : m_maxval(maxval), m_near(near), m_range((maxval + 2 * near) / (2 * near + 1) + 1) {
+    m_qbpp = bits_for(m_range);
+    int bpp = std::max(2, bits_for(maxval + 1));
+    m_limit = 2 * (bpp + std::max(8, bpp));
+
+    // Default JPEG-LS thresholds, scaled for alphabets wider than 8 bits.
+    int factor = (std::min(maxval, 4095) + 128) / 256;
+    if (factor < 1) factor = 1;
+    m_t1 = std::clamp(factor * (3 - 2) + 2 + 3 * near, near + 1, maxval);
+    m_t2 = std::clamp(factor * (7 - 3) + 3 + 5 * near, m_t1, maxval);
+    m_t3 = std::clamp(factor * (21 - 4) + 4 + 7 * near, m_t2, maxval);
+
+    int a_init = std::max(2, (m_range + 32) / 64);
+    // Two extra contexts hold the run interruption statistics.
+    m_A.assign(NUM_CONTEXTS + 2, a_init);
+    m_B.assign(NUM_CONTEXTS + 2, 0);
+    m_C.assign(NUM_CONTEXTS + 2, 0);
+    m_N.assign(NUM_CONTEXTS + 2, 1);
+}
+
+int ContextModel::quantize(int d) const {
+    if (d <= -m_t3) return -4;
+    if (d <= -m_t2) return -3;
+    if (d <= -m_t1) return -2;
+    if (d < -m_near) return -1;
+    if (d <= m_near) return 0;
+    if (d < m_t1) return 1;
+    if (d < m_t2) return 2;
+    if (d < m_t3) return 3;
+    return 4;
+}
+
+int ContextModel::context(int a, int b, int c, int d, int& sign) const {
+    int q1 = quantize(d - b);
+    int q2 = quantize(b - c);
+    int q3 = quantize(c - a);
+
+    sign = 1;
+    if (q1 < 0 || (q1 == 0 && (q2 < 0 || (q2 == 0 && q3 < 0)))) {
+        q1 = -q1;
+        q2 = -q2;
+        q3 = -q3;
+        sign = -1;
+    }
+    return (q1 * 9 + q2) * 9 + q3;
+}
+
+int ContextModel::predict(int q, int sign, int a, int b, int c) const {
+    int px;
+    if (c >= std::max(a, b)) {
+        px = std::min(a, b);
+    } else if (c <= std::min(a, b)) {
+        px = std::max(a, b);
+    } else {
+        px = a + b - c;
+    }
+
+    px += (sign > 0) ? m_C[q] : -m_C[q];
+    return std::clamp(px, 0, m_maxval);
+}
+
+int ContextModel::k(int q) const {
+    int k = 0;
+    while ((m_N[q] << k) < m_A[q]) k++;
+    return k;
+}
+
+int ContextModel::map_error(int q, int k, int errval) const {
+    if (m_near == 0 && k == 0 && 2 * m_B[q] <= -m_N[q]) {
+        return (errval >= 0) ? 2 * errval + 1 : -2 * (errval + 1);
+    }
+    return (errval >= 0) ? 2 * errval : -2 * errval - 1;
+}
+
+int ContextModel::unmap_error(int q, int k, int merrval) const {
+    if (m_near == 0 && k == 0 && 2 * m_B[q] <= -m_N[q]) {
+        return (merrval & 1) ? (merrval - 1) / 2 : -(merrval / 2) - 1;
+    }
+    return (merrval & 1) ? -((merrval + 1) / 2) : merrval / 2;
+}
+
+int ContextModel::reduce(int errval) const {
+    if (errval < 0) errval += m_range;
+    if (errval >= (m_range + 1) / 2) errval -= m_range;
+    return errval;
+}
+
+int ContextModel::quantize_error(int errval) const {
+    if (m_near == 0) return errval;
+    if (errval > 0) return (m_near + errval) / (2 * m_near + 1);
+    return -((m_near - errval) / (2 * m_near + 1));
+}
+
+int ContextModel::reconstruct(int px, int errval) const {
+    int step = 2 * m_near + 1;
+    int x = px + errval * step;
+    if (x < -m_near) x += m_range * step;
+    else if (x > m_maxval + m_near) x -= m_range * step;
+    return std::clamp(x, 0, m_maxval);
+}
+
+void ContextModel::update(int q, int errval) {
+    m_B[q] += errval * (2 * m_near + 1);
+    m_A[q] += std::abs(errval);
+
+    if (m_N[q] == RESET) {
+        m_A[q] >>= 1;
+        m_B[q] = (m_B[q] >= 0) ? (m_B[q] >> 1) : -((1 - m_B[q]) >> 1);
+        m_N[q] >>= 1;
+    }
+    m_N[q]++;
+
+    if (m_B[q] <= -m_N[q]) {
+        m_B[q] += m_N[q];
+        if (m_C[q] > MIN_C) m_C[q]--;
+        if (m_B[q] <= -m_N[q]) m_B[q] = -m_N[q] + 1;
+    } else if (m_B[q] > 0) {
+        m_B[q] -= m_N[q];
+        if (m_C[q] < MAX_C) m_C[q]++;
+        if (m_B[q] > 0) m_B[q] = 0;
+    }
+}
+
+int ContextModel::ri_k(int ritype) const {
+    int q = NUM_CONTEXTS + ritype;
+    int temp = (ritype == 0) ? m_A[q] : m_A[q] + (m_N[q] >> 1);
+    int k = 0;
+    while ((m_N[q] << k) < temp) k++;
+    return k;
+}
+
+int ContextModel::ri_map_error(int ritype, int k, int errval) const {
+    int q = NUM_CONTEXTS + ritype;
+    bool map;
+    if (k == 0 && errval > 0 && 2 * m_Nn[ritype] < m_N[q]) {
+        map = true;
+    } else if (errval < 0 && 2 * m_Nn[ritype] >= m_N[q]) {
+        map = true;
+    } else if (errval < 0 && k != 0) {
+        map = true;
+    } else {
+        map = false;
+    }
+    return 2 * std::abs(errval) - ritype - (map ? 1 : 0);
+}
+
+int ContextModel::ri_unmap_error(int ritype, int k, int emerrval) const {
+    int q = NUM_CONTEXTS + ritype;
+    int temp = emerrval + ritype;
+    bool map = temp & 1;
+    int magnitude = (temp + (map ? 1 : 0)) / 2;
+
+    // With k == 0 and few negative errors, the mapped bit marks a positive
+    // error; otherwise it marks a negative one.
+    bool positive_when_mapped = (k == 0 && 2 * m_Nn[ritype] < m_N[q]);
+    bool negative = (map != positive_when_mapped);
+    return negative ? -magnitude : magnitude;
+}
+
+void ContextModel::ri_update(int ritype, int errval, int emerrval) {
+    int q = NUM_CONTEXTS + ritype;
+    if (errval < 0) m_Nn[ritype]++;
+    m_A[q] += (emerrval + 1 - ritype) >> 1;
+
+    if (m_N[q] == RESET) {
+        m_A[q] >>= 1;
+        m_N[q] >>= 1;
+        m_Nn[ritype] >>= 1;
+    }
+    m_N[q]++;
+}
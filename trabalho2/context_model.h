@@ -0,0 +1,89 @@
+#ifndef CONTEXT_MODEL_H
+#define CONTEXT_MODEL_H
+
+#include <vector>
+
+// LOCO-I / JPEG-LS context modeling: local gradients are quantized into
+// 365 contexts, each keeping the A/B/C/N statistics used to pick the
+// Golomb-Rice parameter and to cancel the prediction bias. Encoder and
+// decoder update it the same way, so no side information is needed.
+// With near > 0 errors are quantized with step 2 * near + 1 (JPEG-LS NEAR),
+// bounding the reconstruction error by 'near'.
+class ContextModel {
+public:
+    static const int NUM_CONTEXTS = 365;
+    // Context 0 (all gradients within +-near) switches to run mode instead
+    // of being coded as a regular sample.
+    static const int RUN_CONTEXT = 0;
+
+    explicit ContextModel(int maxval, int near = 0);
+
+    // Context index (0..364) of the gradients around the current pixel.
+    // 'sign' is set to -1 when the context was folded onto its mirror.
+    int context(int a, int b, int c, int d, int& sign) const;
+
+    // MED prediction adjusted by the bias correction of context q.
+    int predict(int q, int sign, int a, int b, int c) const;
+
+    // Golomb-Rice parameter k for context q.
+    int k(int q) const;
+
+    // Error mapping to a non-negative integer (inverted mapping when
+    // k == 0 and the context bias is negative, as in JPEG-LS).
+    int map_error(int q, int k, int errval) const;
+    int unmap_error(int q, int k, int merrval) const;
+
+    // Reduces errval modulo the alphabet range into [-range/2, range/2).
+    int reduce(int errval) const;
+
+    // Near-lossless quantization of a prediction error and reconstruction
+    // of a sample from its prediction and (sign-corrected) quantized error.
+    int quantize_error(int errval) const;
+    int reconstruct(int px, int errval) const;
+
+    void update(int q, int errval);
+
+    // Run mode: run lengths are coded in blocks of 2^run_k() samples, with
+    // the block order adapted through the JPEG-LS J table.
+    int run_k() const { return J[m_run_index]; }
+    void run_hit() { if (m_run_index < 31) m_run_index++; }
+    void run_miss() { if (m_run_index > 0) m_run_index--; }
+
+    // Run interruption sample, coded in one of two dedicated contexts
+    // depending on whether its left and upper neighbours are equal.
+    int ri_k(int ritype) const;
+    int ri_limit() const { return m_limit - J[m_run_index] - 1; }
+    int ri_map_error(int ritype, int k, int errval) const;
+    int ri_unmap_error(int ritype, int k, int emerrval) const;
+    void ri_update(int ritype, int errval, int emerrval);
+
+    int maxval() const { return m_maxval; }
+    int range() const { return m_range; }
+    int limit() const { return m_limit; }
+    int qbpp() const { return m_qbpp; }
+    int near() const { return m_near; }
+
+private:
+    int quantize(int d) const;
+
+    int m_maxval;
+    int m_near;
+    int m_range;
+    int m_qbpp;
+    int m_limit;
+    int m_t1, m_t2, m_t3;
+
+    std::vector<int> m_A;
+    std::vector<int> m_B;
+    std::vector<int> m_C;
+    std::vector<int> m_N;
+    int m_Nn[2] = {0, 0};
+    int m_run_index = 0;
+
+    static const int J[32];
+    static const int RESET = 64;
+    static const int MIN_C = -128;
+    static const int MAX_C = 127;
+};
+
+#endif
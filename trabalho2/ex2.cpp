@@ -1,151 +1,1338 @@
 #include <opencv2/core.hpp>
 #include <opencv2/imgcodecs.hpp>
+#include "pnm_io.h"
 #include <iostream>
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <optional>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
 
-cv::Mat createNegative(const cv::Mat& src) {
-    cv::Mat dst(src.rows, src.cols, src.type());
-    
-    for (int y = 0; y < src.rows; y++) {
-        for (int x = 0; x < src.cols; x++) {
-            if (src.channels() == 3) {
-                cv::Vec3b pixel = src.at<cv::Vec3b>(y, x);
-                dst.at<cv::Vec3b>(y, x) = cv::Vec3b(255 - pixel[0], 255 - pixel[1], 255 - pixel[2]);
+// Point operations change every sample independently of its position, so
+// any sequence of them collapses into one 256-entry table.
+using Lut = std::array<uchar, 256>;
+
+Lut identityLut() {
+    Lut lut;
+    for (int v = 0; v < 256; v++) {
+        lut[v] = static_cast<uchar>(v);
+    }
+    return lut;
+}
+
+void createNegative(Lut& lut) {
+    for (int v = 0; v < 256; v++) {
+        lut[v] = static_cast<uchar>(255 - lut[v]);
+    }
+}
+
+void adjustBrightness(Lut& lut, int delta) {
+    for (int v = 0; v < 256; v++) {
+        int new_val = lut[v] + delta;
+        if (new_val < 0) new_val = 0;
+        if (new_val > 255) new_val = 255;
+        lut[v] = static_cast<uchar>(new_val);
+    }
+}
+
+uchar clampToByte(double v) {
+    return static_cast<uchar>(std::lround(std::clamp(v, 0.0, 255.0)));
+}
+
+// out = 255 * (in / 255)^(1 / g): g > 1 lightens the mid-tones.
+void adjustGamma(Lut& lut, double g) {
+    for (int v = 0; v < 256; v++) {
+        lut[v] = clampToByte(255.0 * std::pow(lut[v] / 255.0, 1.0 / g));
+    }
+}
+
+// Scales the distance from mid-grey by 'factor' (> 1 more contrast).
+void adjustContrast(Lut& lut, double factor) {
+    for (int v = 0; v < 256; v++) {
+        lut[v] = clampToByte((lut[v] - 128.0) * factor + 128.0);
+    }
+}
+
+// Stretches [black, white] to the full range, clipping outside it.
+void adjustLevels(Lut& lut, int black, int white) {
+    for (int v = 0; v < 256; v++) {
+        lut[v] = clampToByte((lut[v] - black) * 255.0 / (white - black));
+    }
+}
+
+void applyThreshold(Lut& lut, int t) {
+    for (int v = 0; v < 256; v++) {
+        lut[v] = (lut[v] >= t) ? 255 : 0;
+    }
+}
+
+// Sample counts per channel. Mirrors and quarter turns only move pixels,
+// so the histogram at any point of a fused chain follows from the one of
+// its input and the table accumulated so far.
+struct Histogram {
+    std::string labels;  // one letter per channel, e.g. "BGR"
+    std::array<std::array<uint64_t, 256>, 3> counts {};
+
+    int channels() const { return static_cast<int>(labels.size()); }
+
+    void merge(const Histogram& other) {
+        for (int c = 0; c < channels(); c++) {
+            for (int v = 0; v < 256; v++) counts[c][v] += other.counts[c][v];
+        }
+    }
+
+    // The histogram of this image after 'lut'.
+    Histogram through(const Lut& lut) const {
+        Histogram h;
+        h.labels = labels;
+        for (int c = 0; c < channels(); c++) {
+            for (int v = 0; v < 256; v++) h.counts[c][lut[v]] += counts[c][v];
+        }
+        return h;
+    }
+
+    // All channels together, since every tone curve applies to each alike.
+    std::array<uint64_t, 256> pooled() const {
+        std::array<uint64_t, 256> all {};
+        for (int c = 0; c < channels(); c++) {
+            for (int v = 0; v < 256; v++) all[v] += counts[c][v];
+        }
+        return all;
+    }
+};
+
+// Counts interleaved samples into CH * WAYS sub-histograms: consecutive
+// samples of a channel go to different tables, so a run of equal values
+// does not make each increment wait for the previous store. The 32-bit
+// sub-counts are merged into 'out' before they can overflow, and by flush().
+template <int CH>
+class SampleCounter {
+public:
+    explicit SampleCounter(Histogram& out) : m_out(out) {}
+    ~SampleCounter() { flush(); }
+
+    void add(const uchar* s, size_t pixels) {
+        size_t i = 0;
+        for (; i + WAYS <= pixels; i += WAYS, s += CH * WAYS) {
+            for (int k = 0; k < CH * WAYS; k++) m_sub[k][s[k]]++;
+        }
+        for (; i < pixels; i++, s += CH) {
+            for (int c = 0; c < CH; c++) m_sub[c][s[c]]++;
+        }
+        m_pending += pixels;
+        if (m_pending >= (size_t{ 1 } << 30)) flush();
+    }
+
+    void flush() {
+        for (int k = 0; k < CH * WAYS; k++) {
+            for (int v = 0; v < 256; v++) m_out.counts[k % CH][v] += m_sub[k][v];
+            m_sub[k].fill(0);
+        }
+        m_pending = 0;
+    }
+
+private:
+    // Enough tables to break up runs; more only adds merge and cache cost.
+    static const int WAYS = (CH == 1) ? 4 : 2;
+    Histogram& m_out;
+    std::array<std::array<uint32_t, 256>, CH * WAYS> m_sub {};
+    size_t m_pending = 0;
+};
+
+// Maps the pooled cumulative distribution onto [0, 255].
+Lut equalizeLut(const std::array<uint64_t, 256>& hist) {
+    uint64_t total = 0, first = 0;
+    for (int v = 0; v < 256; v++) {
+        if (total == 0) first = hist[v];
+        total += hist[v];
+    }
+    Lut lut = identityLut();
+    if (total == first) return lut;  // a single grey level
+    uint64_t cdf = 0;
+    for (int v = 0; v < 256; v++) {
+        cdf += hist[v];
+        double t = (cdf > first) ? static_cast<double>(cdf - first) / (total - first) : 0.0;
+        lut[v] = static_cast<uchar>(std::lround(t * 255.0));
+    }
+    return lut;
+}
+
+// Exposure summary: range, mean, percentiles and clipped shadows/highlights.
+void printHistogram(const Histogram& h) {
+    std::cout << "    channel  min  max    mean   p1  p50  p99   at 0  at 255\n";
+    for (int c = 0; c < h.channels(); c++) {
+        const std::array<uint64_t, 256>& n = h.counts[c];
+        uint64_t total = 0;
+        double sum = 0.0;
+        int lo = 255, hi = 0;
+        for (int v = 0; v < 256; v++) {
+            if (n[v] == 0) continue;
+            total += n[v];
+            sum += static_cast<double>(v) * n[v];
+            lo = std::min(lo, v);
+            hi = std::max(hi, v);
+        }
+        if (total == 0) continue;
+        auto percentile = [&](double q) {
+            uint64_t need = static_cast<uint64_t>(std::ceil(q * total)), seen = 0;
+            for (int v = 0; v < 256; v++) {
+                seen += n[v];
+                if (seen >= std::max<uint64_t>(need, 1)) return v;
+            }
+            return 255;
+        };
+        std::cout << "    " << std::setw(7) << h.labels[c] << std::setw(5) << lo << std::setw(5) << hi << std::fixed
+                  << std::setprecision(1) << std::setw(8) << sum / total << std::setw(5) << percentile(0.01)
+                  << std::setw(5) << percentile(0.5) << std::setw(5) << percentile(0.99) << std::setw(6)
+                  << 100.0 * n[0] / total << "%" << std::setw(7) << 100.0 * n[255] / total << "%\n";
+        std::cout.unsetf(std::ios::fixed);
+    }
+}
+
+// Geometric operations (mirrors and rotations by multiples of 90 degrees)
+// only move pixels. Each one maps output coordinates back to input ones:
+//
+//   src_x = xx * x + xy * y + x0
+//   src_y = yx * x + yy * y + y0
+//
+// and a chain of them composes into a single such map.
+struct Remap {
+    int xx = 1, xy = 0, x0 = 0;
+    int yx = 0, yy = 1, y0 = 0;
+    int cols = 0, rows = 0;  // output size
+
+    bool isIdentity() const {
+        return xx == 1 && xy == 0 && x0 == 0 && yx == 0 && yy == 1 && y0 == 0;
+    }
+
+    // Appends 'op', which takes the current output as its input.
+    void then(const Remap& op) {
+        Remap r = *this;
+        r.xx = xx * op.xx + xy * op.yx;
+        r.xy = xx * op.xy + xy * op.yy;
+        r.x0 = xx * op.x0 + xy * op.y0 + x0;
+        r.yx = yx * op.xx + yy * op.yx;
+        r.yy = yx * op.xy + yy * op.yy;
+        r.y0 = yx * op.x0 + yy * op.y0 + y0;
+        r.cols = op.cols;
+        r.rows = op.rows;
+        *this = r;
+    }
+};
+
+Remap mirrorHorizontal(int cols, int rows) {
+    return { -1, 0, cols - 1, 0, 1, 0, cols, rows };
+}
+
+Remap mirrorVertical(int cols, int rows) {
+    return { 1, 0, 0, 0, -1, rows - 1, cols, rows };
+}
+
+Remap rotate(int cols, int rows, int angle) {
+    if (angle == 90) {
+        // 90 degrees clockwise: dst(x, y) = src(y, rows - 1 - x)
+        return { 0, 1, 0, -1, 0, rows - 1, rows, cols };
+    } else if (angle == 180) {
+        return { -1, 0, cols - 1, 0, -1, rows - 1, cols, rows };
+    } else {
+        // 270 degrees: dst(x, y) = src(cols - 1 - y, x)
+        return { 0, -1, cols - 1, 1, 0, 0, rows, cols };
+    }
+}
+
+struct Operation {
+    std::string name;
+    std::vector<double> params;
+};
+
+// Number of ':'-separated parameters each operation takes.
+int paramCount(const std::string& name) {
+    if (name == "rotate" || name == "brightness" || name == "gamma" || name == "contrast" || name == "threshold" ||
+        name == "clahe") {
+        return 1;
+    }
+    if (name == "levels") return 2;
+    return 0;
+}
+
+// The whole chain reduced to one table and one remap.
+struct Pipeline {
+    Lut lut = identityLut();
+    bool has_lut = false;
+    Remap remap;
+};
+
+// Parses "op[:param[:param]],op[:param],...".
+bool parseChain(const std::string& chain, std::vector<Operation>& ops) {
+    std::stringstream ss(chain);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        Operation op;
+        std::stringstream fields(item);
+        std::getline(fields, op.name, ':');
+        std::string value;
+        while (std::getline(fields, value, ':')) {
+            char* end = nullptr;
+            op.params.push_back(std::strtod(value.c_str(), &end));
+            if (value.empty() || *end != '\0') {
+                std::cout << "Error: invalid parameter '" << value << "' for " << op.name << "\n";
+                return false;
+            }
+        }
+        int needed = paramCount(op.name);
+        if (static_cast<int>(op.params.size()) != needed) {
+            std::cout << "Error: '" << op.name << "' ";
+            if (needed == 0) {
+                std::cout << "takes no parameter\n";
             } else {
-                uchar pixel = src.at<uchar>(y, x);
-                dst.at<uchar>(y, x) = 255 - pixel;
+                std::cout << "requires " << needed << " parameter" << (needed > 1 ? "s" : "") << " (e.g. " << op.name
+                          << (needed > 1 ? ":16:235" : ":90") << ")\n";
             }
+            return false;
         }
+        ops.push_back(op);
     }
-    return dst;
+    return !ops.empty();
 }
 
-cv::Mat mirrorHorizontal(const cv::Mat& src) {
-    cv::Mat dst(src.rows, src.cols, src.type());
-    
-    for (int y = 0; y < src.rows; y++) {
-        for (int x = 0; x < src.cols; x++) {
-            if (src.channels() == 3) {
-                dst.at<cv::Vec3b>(y, x) = src.at<cv::Vec3b>(y, src.cols - 1 - x);
+// 'source_hist' gives the histogram of the image the chain starts from, for
+// histogram and equalize; it is only called when one of them is present.
+bool buildPipeline(const std::vector<Operation>& ops, int cols, int rows, Pipeline& p,
+                   const std::function<const Histogram&()>& source_hist) {
+    p.remap.cols = cols;
+    p.remap.rows = rows;
+    for (const Operation& op : ops) {
+        int w = p.remap.cols;
+        int h = p.remap.rows;
+        if (op.name == "negative") {
+            std::cout << "  negative\n";
+            createNegative(p.lut);
+            p.has_lut = true;
+        } else if (op.name == "brightness") {
+            int delta = static_cast<int>(op.params[0]);
+            std::cout << "  brightness " << delta << "\n";
+            adjustBrightness(p.lut, delta);
+            p.has_lut = true;
+        } else if (op.name == "gamma") {
+            if (op.params[0] <= 0.0) {
+                std::cout << "Error: gamma must be positive\n";
+                return false;
+            }
+            std::cout << "  gamma " << op.params[0] << "\n";
+            adjustGamma(p.lut, op.params[0]);
+            p.has_lut = true;
+        } else if (op.name == "contrast") {
+            if (op.params[0] < 0.0) {
+                std::cout << "Error: contrast factor must not be negative\n";
+                return false;
+            }
+            std::cout << "  contrast " << op.params[0] << "\n";
+            adjustContrast(p.lut, op.params[0]);
+            p.has_lut = true;
+        } else if (op.name == "levels") {
+            int black = static_cast<int>(op.params[0]);
+            int white = static_cast<int>(op.params[1]);
+            if (black < 0 || white > 255 || black >= white) {
+                std::cout << "Error: levels needs 0 <= black < white <= 255\n";
+                return false;
+            }
+            std::cout << "  levels " << black << " to " << white << "\n";
+            adjustLevels(p.lut, black, white);
+            p.has_lut = true;
+        } else if (op.name == "threshold") {
+            int t = static_cast<int>(op.params[0]);
+            std::cout << "  threshold " << t << "\n";
+            applyThreshold(p.lut, t);
+            p.has_lut = true;
+        } else if (op.name == "histogram" || op.name == "equalize") {
+            Histogram h = p.has_lut ? source_hist().through(p.lut) : source_hist();
+            if (op.name == "histogram") {
+                std::cout << "  histogram\n";
+                printHistogram(h);
             } else {
-                dst.at<uchar>(y, x) = src.at<uchar>(y, src.cols - 1 - x);
+                // Folded into the table like any other tone curve.
+                std::cout << "  equalize\n";
+                Lut eq = equalizeLut(h.pooled());
+                for (int v = 0; v < 256; v++) p.lut[v] = eq[p.lut[v]];
+                p.has_lut = true;
+            }
+        } else if (op.name == "mirror_h") {
+            std::cout << "  mirror horizontally\n";
+            p.remap.then(mirrorHorizontal(w, h));
+        } else if (op.name == "mirror_v") {
+            std::cout << "  mirror vertically\n";
+            p.remap.then(mirrorVertical(w, h));
+        } else if (op.name == "rotate") {
+            int degrees = static_cast<int>(op.params[0]);
+            int angle = ((degrees % 360) + 360) % 360;
+            if (angle % 90 != 0 || static_cast<double>(degrees) != op.params[0]) {
+                std::cout << "Error: only quarter turns can be fused (got " << op.params[0] << ")\n";
+                return false;
+            }
+            std::cout << "  rotate " << degrees << " degrees\n";
+            if (angle != 0) p.remap.then(rotate(w, h, angle));
+        } else {
+            std::cout << "Error: Unknown operation '" << op.name << "'\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Output tile edge, in pixels, for the transposing remaps (quarter turns).
+// Those read the source down a column, one row stride per pixel; inside a
+// tile the source rows touched stay in L1 until the next output row needs
+// them, instead of every pixel missing the cache on a large image.
+const int TILE = 32;
+
+// Applies the pipeline to the output rectangle [x0, x1) x [y0, y1). Every
+// pixel is fetched through the remap and passed through the table; along
+// an output row the source address moves by a constant stride, so the
+// inner loop needs no coordinate arithmetic.
+template <int CH, bool USE_LUT>
+void runBlock(const cv::Mat& src, cv::Mat& dst, const Pipeline& p, int x0, int x1, int y0, int y1) {
+    const Remap& m = p.remap;
+    const ptrdiff_t step = static_cast<ptrdiff_t>(src.step);
+    const ptrdiff_t stride = m.xx * CH + m.yx * step;
+
+    for (int y = y0; y < y1; y++) {
+        const uchar* s = src.data + static_cast<ptrdiff_t>(m.xx * x0 + m.xy * y + m.x0) * CH
+                         + static_cast<ptrdiff_t>(m.yx * x0 + m.yy * y + m.y0) * step;
+        uchar* d = dst.ptr<uchar>(y) + static_cast<size_t>(x0) * CH;
+        for (int x = x0; x < x1; x++, s += stride, d += CH) {
+            for (int c = 0; c < CH; c++) {
+                d[c] = USE_LUT ? p.lut[s[c]] : s[c];
+            }
+        }
+    }
+}
+
+// A quarter turn over the output rectangle [x0, x1) x [y0, y1), in 4x4
+// blocks. The four output pixels of a block column are four neighbours
+// along one source row, so each block is read as four 4-pixel runs and
+// written as four 4-pixel runs, instead of sixteen scattered pixels.
+// Whatever is left over at the right and bottom goes through runBlock().
+template <int CH, bool USE_LUT>
+void runQuads(const cv::Mat& src, cv::Mat& dst, const Pipeline& p, int x0, int x1, int y0, int y1) {
+    const Remap& m = p.remap;
+    const ptrdiff_t step = static_cast<ptrdiff_t>(src.step);
+    const ptrdiff_t next_col = m.yx * step;  // source move for output x + 1
+    const int last = (m.xy < 0) ? 3 : 0;     // run index of output row y
+    const int qx1 = x0 + (x1 - x0) / 4 * 4;
+    const int qy1 = y0 + (y1 - y0) / 4 * 4;
+
+    for (int y = y0; y < qy1; y += 4) {
+        // Runs start at their lowest address: for 270 degrees that is the
+        // source pixel of output row y + 3.
+        const uchar* s = src.data + static_cast<ptrdiff_t>(m.xy * (y + last) + m.x0) * CH
+                         + static_cast<ptrdiff_t>(m.yx * x0 + m.y0) * step;
+        for (int x = x0; x < qx1; x += 4, s += 4 * next_col) {
+            uchar run[4][4 * CH];
+            for (int i = 0; i < 4; i++) std::memcpy(run[i], s + i * next_col, 4 * CH);
+            for (int j = 0; j < 4; j++) {
+                uchar out[4 * CH];
+                const int k = (j ^ last) * CH;
+                for (int i = 0; i < 4; i++) {
+                    for (int c = 0; c < CH; c++) out[i * CH + c] = USE_LUT ? p.lut[run[i][k + c]] : run[i][k + c];
+                }
+                std::memcpy(dst.ptr<uchar>(y + j) + static_cast<size_t>(x) * CH, out, 4 * CH);
+            }
+        }
+    }
+    if (qx1 < x1) runBlock<CH, USE_LUT>(src, dst, p, qx1, x1, y0, qy1);
+    if (qy1 < y1) runBlock<CH, USE_LUT>(src, dst, p, x0, x1, qy1, y1);
+}
+
+// Output rows [y0, y1) of the remap.
+template <int CH, bool USE_LUT>
+void runRemap(const cv::Mat& src, cv::Mat& dst, const Pipeline& p, int y0, int y1) {
+    if (p.remap.xx != 0) {
+        // Mirrors and 180 degrees keep source rows as rows.
+        runBlock<CH, USE_LUT>(src, dst, p, 0, dst.cols, y0, y1);
+        return;
+    }
+    for (int ty = y0; ty < y1; ty += TILE) {
+        for (int tx = 0; tx < dst.cols; tx += TILE) {
+            runQuads<CH, USE_LUT>(src, dst, p, tx, std::min(tx + TILE, dst.cols), ty, std::min(ty + TILE, y1));
+        }
+    }
+}
+
+// Runs at about one byte per cycle, half of memcpy: two loads per byte.
+// Vector units have no byte gather (short of AVX-512 VBMI permutes), so
+// this stays scalar; wider unrolls and 64-bit loads or stores measured no
+// faster.
+void applyLut(const uchar* s, uchar* d, size_t n, const Lut& lut) {
+    // Four lookups per iteration keep independent loads in flight.
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        uchar a = lut[s[i]], b = lut[s[i + 1]], c = lut[s[i + 2]], e = lut[s[i + 3]];
+        d[i] = a;
+        d[i + 1] = b;
+        d[i + 2] = c;
+        d[i + 3] = e;
+    }
+    for (; i < n; i++) {
+        d[i] = lut[s[i]];
+    }
+}
+
+// Splits [0, n) into one band per thread and runs f(begin, end) on each.
+// Inner band bounds are multiples of 'align', so two threads never write
+// to the same cache line (or, for the tiled remap, the same tile row).
+template <typename F>
+void forBands(size_t n, size_t align, int threads, F f) {
+    size_t units = (n + align - 1) / align;
+    threads = static_cast<int>(std::max<size_t>(1, std::min<size_t>(threads, units)));
+    if (threads == 1) {
+        f(size_t{ 0 }, n);
+        return;
+    }
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        size_t b0 = std::min(n, units * t / threads * align);
+        size_t b1 = std::min(n, units * (t + 1) / threads * align);
+        workers.emplace_back(f, b0, b1);
+    }
+    for (std::thread& w : workers) {
+        w.join();
+    }
+}
+
+Histogram computeHistogram(const cv::Mat& img, const std::string& labels, int threads = 1) {
+    Histogram total;
+    total.labels = labels;
+    std::mutex merge;
+    forBands(img.rows, 1, threads, [&](size_t b, size_t e) {
+        Histogram part;
+        part.labels = labels;
+        {
+            SampleCounter<3> rgb(part);
+            SampleCounter<1> grey(part);
+            for (size_t y = b; y < e; y++) {
+                const uchar* row = img.ptr<uchar>(static_cast<int>(y));
+                img.channels() == 3 ? rgb.add(row, img.cols) : grey.add(row, img.cols);
             }
         }
+        std::lock_guard<std::mutex> lock(merge);
+        total.merge(part);
+    });
+    return total;
+}
+
+cv::Mat runPipeline(const cv::Mat& src, const Pipeline& p, int threads = 1) {
+    if (p.remap.isIdentity()) {
+        if (!p.has_lut) return src.clone();
+        // Point operations only: a straight pass over the raw rows, or over
+        // the whole buffer, cut on cache lines, when it has no padding.
+        cv::Mat dst(src.rows, src.cols, src.type());
+        const size_t row_len = static_cast<size_t>(src.cols) * src.channels();
+        if (src.isContinuous() && dst.isContinuous()) {
+            forBands(row_len * src.rows, 64, threads, [&](size_t b, size_t e) {
+                applyLut(src.data + b, dst.data + b, e - b, p.lut);
+            });
+        } else {
+            forBands(src.rows, 1, threads, [&](size_t b, size_t e) {
+                for (size_t y = b; y < e; y++) {
+                    applyLut(src.ptr<uchar>(static_cast<int>(y)), dst.ptr<uchar>(static_cast<int>(y)), row_len, p.lut);
+                }
+            });
+        }
+        return dst;
     }
+
+    cv::Mat dst(p.remap.rows, p.remap.cols, src.type());
+    forBands(dst.rows, (p.remap.xx != 0) ? 1 : TILE, threads, [&](size_t b, size_t e) {
+        int y0 = static_cast<int>(b), y1 = static_cast<int>(e);
+        if (src.channels() == 3) {
+            p.has_lut ? runRemap<3, true>(src, dst, p, y0, y1) : runRemap<3, false>(src, dst, p, y0, y1);
+        } else {
+            p.has_lut ? runRemap<1, true>(src, dst, p, y0, y1) : runRemap<1, false>(src, dst, p, y0, y1);
+        }
+    });
     return dst;
 }
 
-cv::Mat mirrorVertical(const cv::Mat& src) {
-    cv::Mat dst(src.rows, src.cols, src.type());
-    
-    for (int y = 0; y < src.rows; y++) {
-        for (int x = 0; x < src.cols; x++) {
-            if (src.channels() == 3) {
-                dst.at<cv::Vec3b>(y, x) = src.at<cv::Vec3b>(src.rows - 1 - y, x);
+// Exchanges two pixels, passing both through the table.
+template <int CH, bool USE_LUT>
+inline void swapPixels(uchar* a, uchar* b, const Lut& lut) {
+    for (int c = 0; c < CH; c++) {
+        uchar t = a[c];
+        a[c] = USE_LUT ? lut[b[c]] : b[c];
+        b[c] = USE_LUT ? lut[t] : t;
+    }
+}
+
+// Row y of an in-place mirror / 180 degree pipeline, together with the row
+// it trades places with. With both mirrors each pixel's destination is
+// also its source, so the whole remap is a set of pairwise swaps.
+template <int CH, bool USE_LUT>
+void runRowPair(cv::Mat& img, const Pipeline& p, int y) {
+    const Remap& m = p.remap;
+    const int cols = img.cols;
+    uchar* a = img.ptr<uchar>(y);
+    uchar* b = img.ptr<uchar>(m.yy * y + m.y0);
+    if (a != b) {
+        for (int x = 0; x < cols; x++) {
+            swapPixels<CH, USE_LUT>(a + x * CH, b + (m.xx * x + m.x0) * CH, p.lut);
+        }
+        return;
+    }
+    if (m.xx == 1) {
+        if (USE_LUT) applyLut(a, a, static_cast<size_t>(cols) * CH, p.lut);
+        return;
+    }
+    for (int x = 0; x < cols / 2; x++) {
+        swapPixels<CH, USE_LUT>(a + x * CH, a + (cols - 1 - x) * CH, p.lut);
+    }
+    if (USE_LUT && cols % 2 == 1) {
+        // The middle column stays where it is.
+        applyLut(a + cols / 2 * CH, a + cols / 2 * CH, CH, p.lut);
+    }
+}
+
+// Runs the pipeline over 'img' itself when it keeps the image shape (point
+// operations, mirrors, 180 degrees), so no output image is allocated.
+// Returns false for the quarter turns, which change the shape.
+bool runInPlace(cv::Mat& img, const Pipeline& p, int threads = 1) {
+    const Remap& m = p.remap;
+    if (m.xx == 0) return false;
+    if (m.isIdentity()) {
+        if (!p.has_lut) return true;
+        const size_t row_len = static_cast<size_t>(img.cols) * img.channels();
+        if (img.isContinuous()) {
+            forBands(row_len * img.rows, 64, threads, [&](size_t b, size_t e) {
+                applyLut(img.data + b, img.data + b, e - b, p.lut);
+            });
+        } else {
+            forBands(img.rows, 1, threads, [&](size_t b, size_t e) {
+                for (size_t y = b; y < e; y++) {
+                    uchar* row = img.ptr<uchar>(static_cast<int>(y));
+                    applyLut(row, row, row_len, p.lut);
+                }
+            });
+        }
+        return true;
+    }
+
+    // A vertical flip pairs row y with rows - 1 - y: only the top half
+    // (and the middle row) is visited.
+    const int pairs = (m.yy == -1) ? (img.rows + 1) / 2 : img.rows;
+    forBands(pairs, 1, threads, [&](size_t b, size_t e) {
+        for (int y = static_cast<int>(b); y < static_cast<int>(e); y++) {
+            if (img.channels() == 3) {
+                p.has_lut ? runRowPair<3, true>(img, p, y) : runRowPair<3, false>(img, p, y);
             } else {
-                dst.at<uchar>(y, x) = src.at<uchar>(src.rows - 1 - y, x);
+                p.has_lut ? runRowPair<1, true>(img, p, y) : runRowPair<1, false>(img, p, y);
+            }
+        }
+    });
+    return true;
+}
+
+// ---- Rotation by arbitrary angles ----
+
+// Angles that are not quarter turns resample the image, so they can be
+// neither composed into a Remap nor swapped with the tone table.
+bool isFreeRotation(const Operation& op) {
+    return op.name == "rotate" && std::fmod(op.params[0], 90.0) != 0.0;
+}
+
+// Operations that need the pixels produced so far, and so end a fused run.
+bool isBarrier(const Operation& op) {
+    return isFreeRotation(op) || op.name == "clahe";
+}
+
+enum class Interp { Bilinear, Bicubic };
+
+// Source coordinates are 32.32 fixed point; interpolation weights use the
+// top 8 fraction bits.
+const int FRAC_BITS = 32;
+const int64_t FRAC_HALF = int64_t(1) << (FRAC_BITS - 1);
+
+// Catmull-Rom weights for each of the 256 fractions, scaled to sum to 1024.
+using CubicTable = std::array<std::array<int, 4>, 256>;
+
+CubicTable cubicWeights() {
+    CubicTable w;
+    for (int f = 0; f < 256; f++) {
+        double t = f / 256.0;
+        double k[4] = { ((-0.5 * t + 1.0) * t - 0.5) * t, (1.5 * t - 2.5) * t * t + 1.0,
+                        ((-1.5 * t + 2.0) * t + 0.5) * t, (0.5 * t - 0.5) * t * t };
+        int sum = 0;
+        for (int i = 0; i < 4; i++) {
+            w[f][i] = static_cast<int>(std::lround(k[i] * 1024.0));
+            sum += w[f][i];
+        }
+        w[f][f < 128 ? 1 : 2] += 1024 - sum;  // rounding goes to the nearest tap
+    }
+    return w;
+}
+
+// Output rows [y0, y1). Along a row the source point moves by a constant
+// (dx, dy), so it is stepped rather than recomputed. Points within half a
+// pixel of the image sample it with replicated edges; the rest are black.
+// Output columns u in [0, n) whose fixed-point source coordinate
+// p + u * dp lies in [lo, hi], as a half-open range (empty: first == second).
+std::pair<int, int> columnSpan(int64_t p, int64_t dp, int64_t lo, int64_t hi, int n) {
+    auto floorDiv = [](int64_t a, int64_t b) { return a / b - ((a % b != 0) && ((a < 0) != (b < 0))); };
+    int64_t u0 = 0, u1 = n;
+    if (dp > 0) {
+        u0 = -floorDiv(p - lo, dp);
+        u1 = floorDiv(hi - p, dp) + 1;
+    } else if (dp < 0) {
+        u0 = -floorDiv(hi - p, -dp);
+        u1 = floorDiv(p - lo, -dp) + 1;
+    } else if (p < lo || p > hi) {
+        u1 = 0;
+    }
+    u0 = std::clamp<int64_t>(u0, 0, n);
+    u1 = std::clamp<int64_t>(u1, u0, n);
+    return { static_cast<int>(u0), static_cast<int>(u1) };
+}
+
+// Source image of a resampling pass, held by value: the output is written
+// through uchar pointers, which could otherwise alias the cv::Mat header
+// and force it to be reloaded for every pixel.
+struct SourcePlane {
+    const uchar* data;
+    ptrdiff_t step;
+    int w, h;
+};
+
+// One output pixel sampled around the fixed-point source point (sx, sy).
+// INNER pixels have every tap inside the image; the others clamp theirs.
+template <int CH, Interp MODE, bool INNER>
+inline void samplePixel(const SourcePlane src, const CubicTable& cubic, int64_t sx, int64_t sy, uchar* d) {
+    const int w = src.w, h = src.h;
+    const ptrdiff_t step = src.step;
+    int ix = static_cast<int>(sx >> FRAC_BITS), iy = static_cast<int>(sy >> FRAC_BITS);
+    int fx = static_cast<int>(sx >> (FRAC_BITS - 8)) & 255;
+    int fy = static_cast<int>(sy >> (FRAC_BITS - 8)) & 255;
+
+    if (MODE == Interp::Bilinear) {
+        ptrdiff_t x0, x1;
+        const uchar *r0, *r1;
+        if (INNER) {
+            x0 = static_cast<ptrdiff_t>(ix) * CH;
+            x1 = x0 + CH;
+            r0 = src.data + iy * step;
+            r1 = r0 + step;
+        } else {
+            x0 = std::clamp(ix, 0, w - 1) * CH;
+            x1 = std::clamp(ix + 1, 0, w - 1) * CH;
+            r0 = src.data + std::clamp(iy, 0, h - 1) * step;
+            r1 = src.data + std::clamp(iy + 1, 0, h - 1) * step;
+        }
+        for (int ch = 0; ch < CH; ch++) {
+            int top = r0[x0 + ch] * 256 + (r0[x1 + ch] - r0[x0 + ch]) * fx;
+            int bot = r1[x0 + ch] * 256 + (r1[x1 + ch] - r1[x0 + ch]) * fx;
+            d[ch] = static_cast<uchar>((top * 256 + (bot - top) * fy + 32768) >> 16);
+        }
+    } else {
+        ptrdiff_t xs[4];
+        const uchar* rs[4];
+        for (int i = 0; i < 4; i++) {
+            xs[i] = (INNER ? ix - 1 + i : std::clamp(ix - 1 + i, 0, w - 1)) * CH;
+            rs[i] = src.data + (INNER ? iy - 1 + i : std::clamp(iy - 1 + i, 0, h - 1)) * step;
+        }
+        const std::array<int, 4>& wx = cubic[fx];
+        const std::array<int, 4>& wy = cubic[fy];
+        for (int ch = 0; ch < CH; ch++) {
+            int acc = 0;
+            for (int j = 0; j < 4; j++) {
+                const uchar* r = rs[j] + ch;
+                acc += (r[xs[0]] * wx[0] + r[xs[1]] * wx[1] + r[xs[2]] * wx[2] + r[xs[3]] * wx[3]) * wy[j];
             }
+            d[ch] = static_cast<uchar>(std::clamp((acc + (1 << 19)) >> 20, 0, 255));
         }
     }
+}
+
+template <int CH, Interp MODE>
+void rotateRows(const cv::Mat& src, cv::Mat& dst, double c, double s, int y0, int y1) {
+    static const CubicTable cubic = cubicWeights();
+    const int w = src.cols, h = src.rows;
+    const double cx = (w - 1) / 2.0, cy = (h - 1) / 2.0;
+    const double ocx = (dst.cols - 1) / 2.0, ocy = (dst.rows - 1) / 2.0;
+    const double one = std::ldexp(1.0, FRAC_BITS);
+    const int64_t dx = std::llround(c * one), dy = std::llround(-s * one);
+    const int64_t unit = int64_t(1) << FRAC_BITS;
+    const SourcePlane plane { src.data, static_cast<ptrdiff_t>(src.step), w, h };
+    const int taps = (MODE == Interp::Bilinear) ? 2 : 4;
+    const int back = (MODE == Interp::Bilinear) ? 0 : 1;
+
+    for (int v = y0; v < y1; v++) {
+        // Inverse of the clockwise rotation about the centres.
+        double u0 = -ocx, v0 = v - ocy;
+        const int64_t sx = std::llround((cx + u0 * c + v0 * s) * one);
+        const int64_t sy = std::llround((cy - u0 * s + v0 * c) * one);
+
+        // The row splits into spans: black where the nearest source pixel
+        // is outside the image, clamped taps near its edges, and plain
+        // taps in between, so the per-pixel loops have no tests.
+        auto intersect = [](std::pair<int, int> a, std::pair<int, int> b) {
+            int first = std::max(a.first, b.first);
+            return std::make_pair(first, std::max(first, std::min(a.second, b.second)));
+        };
+        auto [a0, a1] = intersect(columnSpan(sx, dx, -FRAC_HALF, w * unit - 1 - FRAC_HALF, dst.cols),
+                                  columnSpan(sy, dy, -FRAC_HALF, h * unit - 1 - FRAC_HALF, dst.cols));
+        auto [b0, b1] = intersect(columnSpan(sx, dx, back * unit, (w - taps + back + 1) * unit - 1, dst.cols),
+                                  columnSpan(sy, dy, back * unit, (h - taps + back + 1) * unit - 1, dst.cols));
+        b0 = std::clamp(b0, a0, a1);
+        b1 = std::clamp(b1, b0, a1);
+
+        uchar* d = dst.ptr<uchar>(v);
+        std::memset(d, 0, static_cast<size_t>(a0) * CH);
+        for (int u = a0; u < b0; u++) samplePixel<CH, MODE, false>(plane, cubic, sx + u * dx, sy + u * dy, d + u * CH);
+        for (int u = b0; u < b1; u++) samplePixel<CH, MODE, true>(plane, cubic, sx + u * dx, sy + u * dy, d + u * CH);
+        for (int u = b1; u < a1; u++) samplePixel<CH, MODE, false>(plane, cubic, sx + u * dx, sy + u * dy, d + u * CH);
+        std::memset(d + static_cast<size_t>(a1) * CH, 0, static_cast<size_t>(dst.cols - a1) * CH);
+    }
+}
+
+// Rotates clockwise by 'degrees' into the bounding box of the rotated
+// image, so no pixel centre is cropped; the uncovered corners are black.
+cv::Mat rotateFree(const cv::Mat& src, double degrees, Interp interp, int threads = 1) {
+    const double rad = degrees * std::acos(-1.0) / 180.0;
+    const double c = std::cos(rad), s = std::sin(rad);
+    // Extent of the rotated corners, rounded to the nearest pixel. The pixel
+    // centres span that extent less |c| + |s| >= 1, so rounding down by up
+    // to half a pixel still keeps every one of them inside, and a small
+    // angle does not add a black border row or column.
+    int cols = static_cast<int>(std::lround(std::abs(src.cols * c) + std::abs(src.rows * s)));
+    int rows = static_cast<int>(std::lround(std::abs(src.cols * s) + std::abs(src.rows * c)));
+    cv::Mat dst(std::max(rows, 1), std::max(cols, 1), src.type());
+
+    forBands(dst.rows, 1, threads, [&](size_t b, size_t e) {
+        int y0 = static_cast<int>(b), y1 = static_cast<int>(e);
+        if (src.channels() == 3) {
+            interp == Interp::Bicubic ? rotateRows<3, Interp::Bicubic>(src, dst, c, s, y0, y1)
+                                      : rotateRows<3, Interp::Bilinear>(src, dst, c, s, y0, y1);
+        } else {
+            interp == Interp::Bicubic ? rotateRows<1, Interp::Bicubic>(src, dst, c, s, y0, y1)
+                                      : rotateRows<1, Interp::Bilinear>(src, dst, c, s, y0, y1);
+        }
+    });
     return dst;
 }
 
-cv::Mat rotate(const cv::Mat& src, int angle) {
-    cv::Mat dst;
-    
-    if (angle == 90) {
-        // 90 degrees clockwise
-        dst = cv::Mat(src.cols, src.rows, src.type());
-        for (int y = 0; y < src.rows; y++) {
-            for (int x = 0; x < src.cols; x++) {
-                int new_y = x;
-                int new_x = src.rows - 1 - y;
-                if (src.channels() == 3) {
-                    dst.at<cv::Vec3b>(new_y, new_x) = src.at<cv::Vec3b>(y, x);
-                } else {
-                    dst.at<uchar>(new_y, new_x) = src.at<uchar>(y, x);
+// ---- Contrast-limited adaptive equalization ----
+
+// Blend positions along one axis: each pixel sits between the centres of
+// tiles t0 and t1 with weight w / 256 on t1 (clamped at the borders).
+struct TileBlend {
+    int t0, t1, w;
+};
+
+std::vector<TileBlend> tileBlends(int size, int tiles) {
+    std::vector<TileBlend> blend(size);
+    for (int i = 0; i < size; i++) {
+        double f = (i + 0.5) * tiles / size - 0.5;
+        int t0 = std::clamp(static_cast<int>(std::floor(f)), 0, tiles - 1);
+        int t1 = std::min(t0 + 1, tiles - 1);
+        int w = static_cast<int>(std::lround(std::clamp(f - t0, 0.0, 1.0) * 256.0));
+        blend[i] = { t0, t1, (t0 == t1) ? 0 : w };
+    }
+    return blend;
+}
+
+// CLAHE over an 8x8 grid of tiles, in place. Each tile's histogram (all
+// channels pooled) is clipped at 'clip' times its mean bin height, the
+// excess spread evenly over all bins, and its cumulative distribution
+// becomes the tile's table; every pixel blends the tables of the four
+// nearest tile centres.
+void applyClahe(cv::Mat& img, double clip, int threads = 1) {
+    const int CH = img.channels();
+    const int gx = std::min(8, img.cols), gy = std::min(8, img.rows);
+    std::vector<Lut> luts(static_cast<size_t>(gx) * gy);
+
+    forBands(gy, 1, threads, [&](size_t b, size_t e) {
+        for (int ty = static_cast<int>(b); ty < static_cast<int>(e); ty++) {
+            const int y0 = ty * img.rows / gy, y1 = (ty + 1) * img.rows / gy;
+            for (int tx = 0; tx < gx; tx++) {
+                const int x0 = tx * img.cols / gx, x1 = (tx + 1) * img.cols / gx;
+                Histogram h;
+                h.labels = std::string(CH, ' ');
+                {
+                    SampleCounter<3> rgb(h);
+                    SampleCounter<1> grey(h);
+                    for (int y = y0; y < y1; y++) {
+                        const uchar* row = img.ptr<uchar>(y) + static_cast<size_t>(x0) * CH;
+                        CH == 3 ? rgb.add(row, x1 - x0) : grey.add(row, x1 - x0);
+                    }
+                }
+                std::array<uint64_t, 256> n = h.pooled();
+                const uint64_t total = static_cast<uint64_t>(y1 - y0) * (x1 - x0) * CH;
+                const uint64_t limit = std::max<uint64_t>(1, static_cast<uint64_t>(clip * total / 256.0));
+                uint64_t excess = 0;
+                for (uint64_t& c : n) {
+                    if (c > limit) {
+                        excess += c - limit;
+                        c = limit;
+                    }
+                }
+                for (int v = 0; v < 256; v++) {
+                    n[v] += excess / 256 + (static_cast<uint64_t>(v) < excess % 256 ? 1 : 0);
+                }
+                Lut& lut = luts[static_cast<size_t>(ty) * gx + tx];
+                uint64_t cdf = 0;
+                for (int v = 0; v < 256; v++) {
+                    cdf += n[v];
+                    lut[v] = static_cast<uchar>((cdf * 255 + total / 2) / total);
                 }
             }
         }
-    } else if (angle == 180) {
-        dst = cv::Mat(src.rows, src.cols, src.type());
-        for (int y = 0; y < src.rows; y++) {
-            for (int x = 0; x < src.cols; x++) {
-                int new_y = src.rows - 1 - y;
-                int new_x = src.cols - 1 - x;
-                if (src.channels() == 3) {
-                    dst.at<cv::Vec3b>(new_y, new_x) = src.at<cv::Vec3b>(y, x);
-                } else {
-                    dst.at<uchar>(new_y, new_x) = src.at<uchar>(y, x);
+    });
+
+    const std::vector<TileBlend> bx = tileBlends(img.cols, gx);
+    const std::vector<TileBlend> by = tileBlends(img.rows, gy);
+    forBands(img.rows, 1, threads, [&](size_t b, size_t e) {
+        for (int y = static_cast<int>(b); y < static_cast<int>(e); y++) {
+            const Lut* top = &luts[static_cast<size_t>(by[y].t0) * gx];
+            const Lut* bot = &luts[static_cast<size_t>(by[y].t1) * gx];
+            const int wy = by[y].w;
+            uchar* d = img.ptr<uchar>(y);
+            for (int x = 0; x < img.cols; x++) {
+                const TileBlend& t = bx[x];
+                for (int c = 0; c < CH; c++, d++) {
+                    int v = *d;
+                    int upper = top[t.t0][v] * (256 - t.w) + top[t.t1][v] * t.w;
+                    int lower = bot[t.t0][v] * (256 - t.w) + bot[t.t1][v] * t.w;
+                    *d = static_cast<uchar>((upper * (256 - wy) + lower * wy + 32768) >> 16);
                 }
             }
         }
-    } else if (angle == 270) {
-        // 270 degrees
-        dst = cv::Mat(src.cols, src.rows, src.type());
-        for (int y = 0; y < src.rows; y++) {
-            for (int x = 0; x < src.cols; x++) {
-                int new_y = src.cols - 1 - x;
-                int new_x = y;
-                if (src.channels() == 3) {
-                    dst.at<cv::Vec3b>(new_y, new_x) = src.at<cv::Vec3b>(y, x);
-                } else {
-                    dst.at<uchar>(new_y, new_x) = src.at<uchar>(y, x);
+    });
+}
+
+// ---- Streaming path (--stream) for PNM files larger than memory ----
+
+// pread/pwrite until the whole range is transferred.
+bool readAt(int fd, uchar* buf, size_t n, off_t off) {
+    while (n > 0) {
+        ssize_t got = ::pread(fd, buf, n, off);
+        if (got <= 0) return false;
+        buf += got;
+        n -= static_cast<size_t>(got);
+        off += got;
+    }
+    return true;
+}
+
+bool writeAt(int fd, const uchar* buf, size_t n, off_t off) {
+    while (n > 0) {
+        ssize_t put = ::pwrite(fd, buf, n, off);
+        if (put <= 0) return false;
+        buf += put;
+        n -= static_cast<size_t>(put);
+        off += put;
+    }
+    return true;
+}
+
+struct FileHandle {
+    int fd = -1;
+    ~FileHandle() {
+        if (fd >= 0) ::close(fd);
+    }
+};
+
+// Where the raster lives in each file, and how the pipeline maps it.
+struct StreamJob {
+    int in_fd, out_fd;
+    off_t in_offset, out_offset;
+    int in_cols, in_rows, channels;
+    int band, threads;
+    int type() const { return channels == 3 ? CV_8UC3 : CV_8UC1; }
+};
+
+// Chains that keep rows as rows (point operations, mirrors, 180 degrees).
+// Output band [y0, y0 + n) comes from n consecutive input rows, possibly in
+// reverse order, so each band is one read, the in-place pass on a band-
+// sized remap, and one write.
+bool streamRows(const StreamJob& job, const Pipeline& p) {
+    const Remap& m = p.remap;
+    const size_t row_bytes = static_cast<size_t>(job.in_cols) * job.channels;
+    cv::Mat buf(job.band, job.in_cols, job.type());
+    for (int y0 = 0; y0 < m.rows; y0 += job.band) {
+        int n = std::min(job.band, m.rows - y0);
+        int first = std::min(m.yy * y0 + m.y0, m.yy * (y0 + n - 1) + m.y0);
+        cv::Mat rows(n, job.in_cols, job.type(), buf.data);
+        if (!readAt(job.in_fd, rows.data, row_bytes * n, job.in_offset + static_cast<off_t>(row_bytes) * first)) {
+            return false;
+        }
+        Pipeline local = p;
+        local.remap.y0 = (m.yy == -1) ? n - 1 : 0;
+        local.remap.rows = n;
+        runInPlace(rows, local, job.threads);
+        if (!writeAt(job.out_fd, rows.data, row_bytes * n, job.out_offset + static_cast<off_t>(row_bytes) * y0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Quarter turns: output band k needs a strip of input columns from every
+// input row. Pass one reads the input in row bands and writes each band's
+// part of every strip to a scratch file, strip after strip; pass two reads
+// one strip back (now contiguous) and rotates it into one output band.
+bool streamStrips(const StreamJob& job, const Pipeline& p, const std::string& scratch_path) {
+    const Remap& m = p.remap;
+    const int ch = job.channels;
+    const size_t in_row = static_cast<size_t>(job.in_cols) * ch;
+    const int bands = (m.rows + job.band - 1) / job.band;
+
+    // First input column (from the left) of the strip behind output band k.
+    auto stripStart = [&](int k, int n) { return std::min(m.xy * k * job.band + m.x0, m.xy * (k * job.band + n - 1) + m.x0); };
+    auto stripWidth = [&](int k) { return std::min(job.band, m.rows - k * job.band); };
+    auto stripOffset = [&](int k) { return static_cast<off_t>(k) * job.band * job.in_rows * ch; };
+
+    FileHandle scratch;
+    scratch.fd = ::open(scratch_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (scratch.fd < 0) return false;
+    ::unlink(scratch_path.c_str());  // removed once closed
+
+    cv::Mat in_band(job.band, job.in_cols, job.type());
+    std::vector<uchar> piece(static_cast<size_t>(job.band) * job.band * ch);
+    for (int r0 = 0; r0 < job.in_rows; r0 += job.band) {
+        int nr = std::min(job.band, job.in_rows - r0);
+        if (!readAt(job.in_fd, in_band.data, in_row * nr, job.in_offset + static_cast<off_t>(in_row) * r0)) return false;
+        for (int k = 0; k < bands; k++) {
+            int w = stripWidth(k);
+            int lo = stripStart(k, w);
+            size_t piece_row = static_cast<size_t>(w) * ch;
+            for (int r = 0; r < nr; r++) {
+                std::memcpy(piece.data() + r * piece_row, in_band.ptr<uchar>(r) + static_cast<size_t>(lo) * ch, piece_row);
+            }
+            if (!writeAt(scratch.fd, piece.data(), piece_row * nr, stripOffset(k) + static_cast<off_t>(piece_row) * r0)) {
+                return false;
+            }
+        }
+    }
+    in_band = cv::Mat();
+    piece = std::vector<uchar>();
+
+    const size_t out_row = static_cast<size_t>(m.cols) * ch;
+    for (int k = 0; k < bands; k++) {
+        int n = stripWidth(k);
+        int lo = stripStart(k, n);
+        cv::Mat strip(job.in_rows, n, job.type());
+        if (!readAt(scratch.fd, strip.data, static_cast<size_t>(n) * ch * job.in_rows, stripOffset(k))) return false;
+
+        Pipeline local = p;
+        local.remap.x0 = m.xy * k * job.band + m.x0 - lo;
+        local.remap.rows = n;
+        cv::Mat out = runPipeline(strip, local, job.threads);
+        if (!writeAt(job.out_fd, out.data, out_row * n, job.out_offset + static_cast<off_t>(out_row) * k * job.band)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Applies the chain to an 8-bit binary PGM/PPM without ever holding the
+// whole image: memory stays at a few bands of 'band' rows (for the quarter
+// turns, bands of 'band' input columns by the full image height).
+int runStream(const std::string& in_path, const std::string& out_path, const std::vector<Operation>& ops, int band,
+              int threads) {
+    PnmInfo info;
+    size_t in_offset = 0;
+    try {
+        info = read_pnm_header(in_path, in_offset);
+    } catch (const std::exception& e) {
+        std::cout << "Error: " << e.what() << "\n";
+        return -1;
+    }
+    if (info.bytes_per_sample != 1) {
+        std::cout << "Error: streaming supports 8-bit images only\n";
+        return -1;
+    }
+    for (const Operation& op : ops) {
+        if (isBarrier(op)) {
+            std::cout << "Error: clahe and rotations other than quarter turns cannot be streamed\n";
+            return -1;
+        }
+    }
+    std::cout << "Image header: " << info.width << "x" << info.height << ", " << info.channels
+              << " channels (streaming in bands of " << band << " rows)\n";
+
+    // histogram and equalize cost one extra read of the input.
+    std::optional<Histogram> hist;
+    bool hist_ok = true;
+    auto source_hist = [&]() -> const Histogram& {
+        if (!hist) {
+            hist.emplace();
+            hist->labels = (info.channels == 3) ? "RGB" : "Y";
+            const size_t row_bytes = static_cast<size_t>(info.width) * info.channels;
+            std::vector<uchar> buf(row_bytes * band);
+            FileHandle in;
+            in.fd = ::open(in_path.c_str(), O_RDONLY);
+            SampleCounter<3> rgb(*hist);
+            SampleCounter<1> grey(*hist);
+            for (int y0 = 0; y0 < info.height && hist_ok; y0 += band) {
+                int n = std::min(band, info.height - y0);
+                hist_ok = in.fd >= 0 && readAt(in.fd, buf.data(), row_bytes * n,
+                                               static_cast<off_t>(in_offset + row_bytes * y0));
+                if (hist_ok) {
+                    info.channels == 3 ? rgb.add(buf.data(), static_cast<size_t>(info.width) * n)
+                                       : grey.add(buf.data(), static_cast<size_t>(info.width) * n);
                 }
             }
         }
-    } else {
-        dst = src.clone();
+        return *hist;
+    };
+
+    Pipeline pipeline;
+    std::cout << "Applying:\n";
+    if (!buildPipeline(ops, info.width, info.height, pipeline, source_hist)) {
+        return -1;
     }
-    
-    return dst;
+    if (!hist_ok) {
+        std::cout << "Error: Could not read '" << in_path << "'\n";
+        return -1;
+    }
+
+    PnmInfo out_info = info;
+    out_info.width = pipeline.remap.cols;
+    out_info.height = pipeline.remap.rows;
+    const std::string header = pnm_header(out_info);
+
+    FileHandle in, out;
+    in.fd = ::open(in_path.c_str(), O_RDONLY);
+    out.fd = ::open(out_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (in.fd < 0 || out.fd < 0 ||
+        !writeAt(out.fd, reinterpret_cast<const uchar*>(header.data()), header.size(), 0) ||
+        ::ftruncate(out.fd, static_cast<off_t>(header.size() + out_info.raster_bytes())) != 0) {
+        std::cout << "Error: Could not open '" << in_path << "' or create '" << out_path << "'\n";
+        return -1;
+    }
+
+    StreamJob job { in.fd, out.fd, static_cast<off_t>(in_offset), static_cast<off_t>(header.size()),
+                    info.width, info.height, info.channels, band, threads };
+    bool ok = (pipeline.remap.xx != 0) ? streamRows(job, pipeline) : streamStrips(job, pipeline, out_path + ".strips");
+    if (!ok) {
+        std::cout << "Error: I/O failed while streaming '" << in_path << "' to '" << out_path << "'\n";
+        return -1;
+    }
+    std::cout << "Result saved to '" << out_path << "'\n";
+    return 0;
 }
 
-cv::Mat adjustBrightness(const cv::Mat& src, int delta) {
-    cv::Mat dst(src.rows, src.cols, src.type());
-    
+// The rotation loop ex2 used to have (one at<>() per pixel, written in
+// column order), kept as the baseline for --bench.
+cv::Mat rotateReference(const cv::Mat& src, int angle) {
+    cv::Mat dst(src.cols, src.rows, src.type());
     for (int y = 0; y < src.rows; y++) {
         for (int x = 0; x < src.cols; x++) {
-            if (src.channels() == 3) {
-                cv::Vec3b pixel = src.at<cv::Vec3b>(y, x);
-                for (int c = 0; c < 3; c++) {
-                    int new_val = pixel[c] + delta;
-                    if (new_val < 0) new_val = 0;
-                    if (new_val > 255) new_val = 255;
-                    pixel[c] = static_cast<uchar>(new_val);
-                }
-                dst.at<cv::Vec3b>(y, x) = pixel;
-            } else {
-                int pixel = src.at<uchar>(y, x);
-                int new_val = pixel + delta;
-                if (new_val < 0) new_val = 0;
-                if (new_val > 255) new_val = 255;
-                dst.at<uchar>(y, x) = static_cast<uchar>(new_val);
-            }
+            int new_y = (angle == 90) ? x : src.cols - 1 - x;
+            int new_x = (angle == 90) ? src.rows - 1 - y : y;
+            dst.at<cv::Vec3b>(new_y, new_x) = src.at<cv::Vec3b>(y, x);
         }
     }
     return dst;
 }
 
+template <typename F>
+double bestTime(F f, int runs = 3) {
+    double best = 0.0;
+    for (int i = 0; i < runs; i++) {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = (i == 0) ? t : std::min(best, t);
+    }
+    return best;
+}
+
+// Times the quarter turns on a synthetic colour image (8K UHD by default):
+// the old loop, the remap walked row by row, and the tiled remap, on one
+// thread and then on 'threads'. Then a 30 degree resampled rotation and the
+// histogram count.
+int runBenchmark(int cols, int rows, int threads) {
+    cv::Mat src(rows, cols, CV_8UC3);
+    uint32_t state = 12345;
+    for (int y = 0; y < rows; y++) {
+        uchar* s = src.ptr<uchar>(y);
+        for (int i = 0; i < cols * 3; i++) {
+            state = state * 1664525u + 1013904223u;
+            s[i] = static_cast<uchar>(state >> 24);
+        }
+    }
+
+    const double mp = static_cast<double>(cols) * rows / 1e6;
+    std::cout << "Benchmark: " << cols << "x" << rows << ", 3 channels (best of 3)\n";
+    for (int angle : { 90, 270 }) {
+        Pipeline p;
+        p.remap.cols = cols;
+        p.remap.rows = rows;
+        p.remap.then(rotate(cols, rows, angle));
+
+        cv::Mat ref, rows_out, tiled;
+        double t_ref = bestTime([&] { ref = rotateReference(src, angle); });
+        double t_rows = bestTime([&] {
+            rows_out = cv::Mat(p.remap.rows, p.remap.cols, src.type());
+            runBlock<3, false>(src, rows_out, p, 0, rows_out.cols, 0, rows_out.rows);
+        });
+        double t_tiled = bestTime([&] { tiled = runPipeline(src, p); });
+        cv::Mat parallel;
+        double t_par = bestTime([&] { parallel = runPipeline(src, p, threads); });
+
+        bool same = std::memcmp(ref.data, rows_out.data, ref.step * ref.rows) == 0 &&
+                    std::memcmp(ref.data, tiled.data, ref.step * ref.rows) == 0 &&
+                    std::memcmp(ref.data, parallel.data, ref.step * ref.rows) == 0;
+        std::cout << "rotate " << angle << ":\n" << std::fixed << std::setprecision(1)
+                  << "  reference loop  " << std::setw(8) << t_ref * 1e3 << " ms  " << mp / t_ref << " MP/s\n"
+                  << "  remap by rows   " << std::setw(8) << t_rows * 1e3 << " ms  " << mp / t_rows << " MP/s\n"
+                  << "  tiled remap     " << std::setw(8) << t_tiled * 1e3 << " ms  " << mp / t_tiled << " MP/s\n"
+                  << "  tiled, " << std::setw(2) << threads << " thr   " << std::setw(8) << t_par * 1e3 << " ms  "
+                  << mp / t_par << " MP/s\n";
+        if (!same) {
+            std::cout << "Error: results differ from the reference loop\n";
+            return -1;
+        }
+    }
+
+    std::cout << "rotate 30 (resampled):\n";
+    for (Interp interp : { Interp::Bilinear, Interp::Bicubic }) {
+        double t1 = bestTime([&] { rotateFree(src, 30.0, interp); });
+        double tn = bestTime([&] { rotateFree(src, 30.0, interp, threads); });
+        std::cout << "  " << (interp == Interp::Bicubic ? "bicubic " : "bilinear") << ",  1 thr " << std::setw(8)
+                  << t1 * 1e3 << " ms  " << mp / t1 << " MP/s\n"
+                  << "  " << (interp == Interp::Bicubic ? "bicubic " : "bilinear") << ", " << std::setw(2) << threads
+                  << " thr " << std::setw(8) << tn * 1e3 << " ms  " << mp / tn << " MP/s\n";
+    }
+
+    // One shared table per channel, as a plain loop would count.
+    Histogram naive;
+    double t_naive = bestTime([&] {
+        naive = Histogram();
+        naive.labels = "BGR";
+        const uchar* d = src.data;
+        for (size_t i = 0; i < src.total(); i++, d += 3) {
+            for (int c = 0; c < 3; c++) naive.counts[c][d[c]]++;
+        }
+    });
+    Histogram h1, hn;
+    double t_h1 = bestTime([&] { h1 = computeHistogram(src, "BGR"); });
+    double t_hn = bestTime([&] { hn = computeHistogram(src, "BGR", threads); });
+    const double gb = src.total() * 3 / 1e9;
+    std::cout << "histogram:\n"
+              << "  one table       " << std::setw(8) << t_naive * 1e3 << " ms  " << gb / t_naive << " GB/s\n"
+              << "  interleaved     " << std::setw(8) << t_h1 * 1e3 << " ms  " << gb / t_h1 << " GB/s\n"
+              << "  interleaved, " << std::setw(2) << threads << " " << std::setw(8) << t_hn * 1e3 << " ms  "
+              << gb / t_hn << " GB/s\n";
+    if (naive.counts != h1.counts || naive.counts != hn.counts) {
+        std::cout << "Error: histograms differ\n";
+        return -1;
+    }
+    return 0;
+}
+
 void printUsage(const char* prog_name) {
-    std::cout << "Usage: " << prog_name << " <input_image> <output_image> <operation> [params]\n";
-    std::cout << "\nOperations:\n";
-    std::cout << "  negative              - Create negative of image\n";
-    std::cout << "  mirror_h              - Mirror horizontally\n";
-    std::cout << "  mirror_v              - Mirror vertically\n";
-    std::cout << "  rotate <angle>        - Rotate by angle (90, 180, or 270)\n";
-    std::cout << "  brightness <delta>    - Adjust brightness (positive=lighter, negative=darker)\n";
+    std::cout << "Usage: " << prog_name << " [-j threads] [--interp mode] [--stream [--band rows]] <input_image> <output_image> <operations> [param]\n";
+    std::cout << "\nOperations (a comma-separated chain, e.g. negative,brightness:20,mirror_h):\n";
+    std::cout << "  negative               - Create negative of image\n";
+    std::cout << "  mirror_h               - Mirror horizontally\n";
+    std::cout << "  mirror_v               - Mirror vertically\n";
+    std::cout << "  rotate:<angle>         - Rotate clockwise by angle (any, in degrees)\n";
+    std::cout << "  brightness:<delta>     - Adjust brightness (positive=lighter, negative=darker)\n";
+    std::cout << "  gamma:<g>              - Gamma curve (g > 1 lightens mid-tones)\n";
+    std::cout << "  contrast:<factor>      - Scale contrast around mid-grey (> 1 increases)\n";
+    std::cout << "  levels:<black>:<white> - Stretch [black, white] to the full range\n";
+    std::cout << "  threshold:<t>          - Binarize (>= t becomes white)\n";
+    std::cout << "  histogram              - Print an exposure summary of the image at this point\n";
+    std::cout << "  equalize               - Histogram equalization (all channels share one curve)\n";
+    std::cout << "  clahe:<clip>           - Contrast-limited adaptive equalization, 8x8 tiles (e.g. clahe:3)\n";
+    std::cout << "\nThe whole chain is applied in a single pass, except that clahe and rotations\n";
+    std::cout << "by angles other than multiples of 90 work on the image in passes of their own\n";
+    std::cout << "(--interp bilinear|bicubic, default bilinear). A single operation with one\n";
+    std::cout << "parameter may also take it as a separate argument (rotate 90).\n";
+    std::cout << "\n-j splits the output into row bands, one per thread (default: one per core).\n";
+    std::cout << "--stream processes an 8-bit binary PGM/PPM band by band (default 256 rows)\n";
+    std::cout << "instead of loading it, for images larger than memory; the output is PNM.\n";
+    std::cout << "\nBenchmark of the rotations and histogram: " << prog_name << " [-j threads] --bench [width height]\n";
 }
 
 int main(int argc, char* argv[]) {
-    if (argc < 4) {
+    int threads = static_cast<int>(std::thread::hardware_concurrency());
+    bool stream = false;
+    int band = 256;
+    Interp interp = Interp::Bilinear;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-j" && i + 1 < argc) {
+            threads = std::atoi(argv[++i]);
+            if (threads <= 0) {
+                std::cout << "Error: invalid thread count\n";
+                return -1;
+            }
+        } else if (arg == "--interp" && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode != "bilinear" && mode != "bicubic") {
+                std::cout << "Error: interpolation must be bilinear or bicubic\n";
+                return -1;
+            }
+            interp = (mode == "bicubic") ? Interp::Bicubic : Interp::Bilinear;
+        } else if (arg == "--stream") {
+            stream = true;
+        } else if (arg == "--band" && i + 1 < argc) {
+            stream = true;
+            band = std::atoi(argv[++i]);
+            if (band <= 0) {
+                std::cout << "Error: invalid band size\n";
+                return -1;
+            }
+        } else {
+            args.push_back(arg);
+        }
+    }
+
+    if (!args.empty() && args[0] == "--bench") {
+        int cols = (args.size() >= 3) ? std::atoi(args[1].c_str()) : 7680;
+        int rows = (args.size() >= 3) ? std::atoi(args[2].c_str()) : 4320;
+        if (cols <= 0 || rows <= 0) {
+            std::cout << "Error: invalid benchmark size\n";
+            return -1;
+        }
+        return runBenchmark(cols, rows, std::max(threads, 1));
+    }
+
+    if (args.size() < 3) {
         printUsage(argv[0]);
         return -1;
     }
 
-    const char* input_filename = argv[1];
-    const char* output_filename = argv[2];
-    std::string operation = argv[3];
+    const std::string& input_filename = args[0];
+    const std::string& output_filename = args[1];
+    std::string chain = args[2];
+
+    // Old form: "<op> <param>" for a single operation.
+    if (args.size() >= 4 && paramCount(chain) == 1) {
+        chain += ":" + args[3];
+    }
+
+    std::vector<Operation> ops;
+    if (!parseChain(chain, ops)) {
+        printUsage(argv[0]);
+        return -1;
+    }
+
+    if (stream) {
+        return runStream(input_filename, output_filename, ops, band, std::max(threads, 1));
+    }
 
     cv::Mat src = cv::imread(input_filename, cv::IMREAD_COLOR);
     if (src.empty()) {
@@ -155,46 +1342,48 @@ int main(int argc, char* argv[]) {
 
     std::cout << "Image loaded: " << src.cols << "x" << src.rows << ", " << src.channels() << " channels\n";
 
-    cv::Mat result;
-
-    if (operation == "negative") {
-        std::cout << "Creating negative...\n";
-        result = createNegative(src);
-    } 
-    else if (operation == "mirror_h") {
-        std::cout << "Mirroring horizontally...\n";
-        result = mirrorHorizontal(src);
-    } 
-    else if (operation == "mirror_v") {
-        std::cout << "Mirroring vertically...\n";
-        result = mirrorVertical(src);
-    } 
-    else if (operation == "rotate") {
-        if (argc < 5) {
-            std::cout << "Error: rotate requires angle parameter (90, 180, or 270)\n";
-            return -1;
-        }
-        int angle = std::atoi(argv[4]);
-        if (angle != 90 && angle != 180 && angle != 270) {
-            std::cout << "Error: angle must be 90, 180, or 270\n";
-            return -1;
+    // Runs of fusable operations become one pass each; a free rotation or
+    // clahe between them works on the result of the previous run.
+    threads = std::max(threads, 1);
+    cv::Mat result = src;
+    src = cv::Mat();
+    std::cout << "Applying:\n";
+    for (size_t i = 0; i < ops.size();) {
+        size_t j = i;
+        while (j < ops.size() && !isBarrier(ops[j])) j++;
+        if (j > i) {
+            Pipeline pipeline;
+            std::vector<Operation> run(ops.begin() + i, ops.begin() + j);
+            std::optional<Histogram> hist;
+            auto source_hist = [&]() -> const Histogram& {
+                if (!hist) hist = computeHistogram(result, result.channels() == 3 ? "BGR" : "Y", threads);
+                return *hist;
+            };
+            if (!buildPipeline(run, result.cols, result.rows, pipeline, source_hist)) {
+                printUsage(argv[0]);
+                return -1;
+            }
+            // Shape-preserving runs overwrite the image in place; only the
+            // quarter turns need a second one.
+            if (!runInPlace(result, pipeline, threads)) {
+                result = runPipeline(result, pipeline, threads);
+            }
         }
-        std::cout << "Rotating by " << angle << " degrees...\n";
-        result = rotate(src, angle);
-    } 
-    else if (operation == "brightness") {
-        if (argc < 5) {
-            std::cout << "Error: brightness requires delta parameter\n";
-            return -1;
+        if (j < ops.size() && ops[j].name == "clahe") {
+            if (ops[j].params[0] < 1.0) {
+                std::cout << "Error: the clahe clip limit must be at least 1\n";
+                return -1;
+            }
+            std::cout << "  clahe, clip limit " << ops[j].params[0] << "\n";
+            applyClahe(result, ops[j].params[0], threads);
+            j++;
+        } else if (j < ops.size()) {
+            std::cout << "  rotate " << ops[j].params[0] << " degrees ("
+                      << (interp == Interp::Bicubic ? "bicubic" : "bilinear") << ")\n";
+            result = rotateFree(result, ops[j].params[0], interp, threads);
+            j++;
         }
-        int delta = std::atoi(argv[4]);
-        std::cout << "Adjusting brightness by " << delta << "...\n";
-        result = adjustBrightness(src, delta);
-    } 
-    else {
-        std::cout << "Error: Unknown operation '" << operation << "'\n";
-        printUsage(argv[0]);
-        return -1;
+        i = j;
     }
 
     if (cv::imwrite(output_filename, result)) {
@@ -205,4 +1394,4 @@ int main(int argc, char* argv[]) {
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -5,12 +5,35 @@
 void print_usage() {
     std::cerr << "Usage: codec [mode] [options]\n\n"
               << "Modes:\n"
-              << "  -e <input.png> -o <output.gicl>   Encode an image file\n"
-              << "  -d <input.gicl> -o <output.png>   Decode a GICL file\n"
+              << "  -e <input.ppm> -o <output.gicl>   Encode a PGM/PPM image (as grayscale);\n"
+              << "                                    .ppm.gz/.pgm.gz inputs are streamed\n"
+              << "  -d <input.gicl> -o <output.pgm>   Decode a GICL file to PGM\n"
               << "Encode Options:\n"
               << "  -m <value>     Use fixed Golomb parameter 'm' (e.g., -m 10)\n"
               << "  -a             Use adaptive 'm' (block-based, recommended)\n"
               << "                 (If neither -m nor -a is given, -a is default)\n"
+              << "  -k             Online Golomb-Rice k from neighbouring residuals: no 'm'\n"
+              << "                 side info and a single pass (with MED or -p)\n"
+              << "  -p             Pick the best predictor per block (JPEG 1-7, MED, GAP)\n"
+              << "  -c             Use LOCO-I context modeling (JPEG-LS style, no side info)\n"
+              << "                 with run mode; two-level images use a JBIG-like binary coder\n"
+              << "  -r             Resolution-progressive coding (allows fast thumbnails)\n"
+              << "  -q             Quadtree of 8x8 to 64x64 blocks, each with its own predictor\n"
+              << "                 and Golomb-Rice parameter\n"
+              << "  -x             Self-correcting weighted predictor (slower, better ratio\n"
+              << "                 on photographs; side-info-free Golomb-Rice k)\n"
+              << "  -w             Reversible 5/3 wavelet with per-subband Golomb coding\n"
+              << "                 (also allows fast thumbnails)\n"
+              << "  -s             Frame sequence: input and output are numbered patterns such\n"
+              << "                 as frame_%03d.pgm; each frame is predicted from the previous\n"
+              << "                 one (the decoder detects sequences and also takes a pattern)\n"
+              << "  --rows         Store rows as independent substreams (block modes), so\n"
+              << "                 the decoder can work on several rows in a wavefront\n"
+              << "  --near <N>     Near-lossless: every sample within +-N of the original\n"
+              << "                 (JPEG-LS NEAR; default 0 = lossless)\n"
+              << "Decode Options:\n"
+              << "  -t <scale>     Only decode a 1/scale thumbnail (scale = 2, 4 or 8)\n"
+              << "  -j <threads>   Threads for files encoded with --rows (default: one per core)\n"
               << std::endl;
 }
 
@@ -25,6 +48,12 @@ int main(int argc, char* argv[]) {
     std::string out_file;
     int m = -1;
     bool adaptive = false;
+    CodingMode coding_mode = CodingMode::BLOCK_MED;
+    int thumbnail_scale = 1;
+    int near = 0;
+    bool online_k = false;
+    bool row_streams = false;
+    int threads = 0;
 
     for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
@@ -40,6 +69,30 @@ int main(int argc, char* argv[]) {
             if (i + 1 < argc) m = std::stoi(argv[++i]);
         } else if (arg == "-a") {
             adaptive = true;
+        } else if (arg == "--rows") {
+            row_streams = true;
+        } else if (arg == "-j") {
+            if (i + 1 < argc) threads = std::stoi(argv[++i]);
+        } else if (arg == "-k") {
+            online_k = true;
+        } else if (arg == "-p") {
+            coding_mode = CodingMode::BLOCK_SELECT;
+        } else if (arg == "-r") {
+            coding_mode = CodingMode::PROGRESSIVE;
+        } else if (arg == "-s") {
+            coding_mode = CodingMode::SEQUENCE;
+        } else if (arg == "-q") {
+            coding_mode = CodingMode::QUADTREE;
+        } else if (arg == "-x") {
+            coding_mode = CodingMode::WEIGHTED;
+        } else if (arg == "-w") {
+            coding_mode = CodingMode::WAVELET;
+        } else if (arg == "-t") {
+            if (i + 1 < argc) thumbnail_scale = std::stoi(argv[++i]);
+        } else if (arg == "-c") {
+            coding_mode = CodingMode::CONTEXT;
+        } else if (arg == "--near") {
+            if (i + 1 < argc) near = std::stoi(argv[++i]);
         }
     }
 
@@ -61,10 +114,10 @@ int main(int argc, char* argv[]) {
 
     try {
         if (mode == "encode") {
-            ImageCodec codec(in_file, out_file, m, adaptive);
+            ImageCodec codec(in_file, out_file, m, adaptive, coding_mode, near, online_k, row_streams);
             codec.encode();
         } else {
-            ImageCodec codec(in_file, out_file);
+            ImageCodec codec(in_file, out_file, thumbnail_scale, threads);
             codec.decode();
         }
     } catch (const std::exception& e) {
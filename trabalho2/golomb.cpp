@@ -110,4 +110,47 @@ int Golomb::decode(BitStream& bs) {
 
         return (sign_bit == 1) ? -(int)abs_val : (int)abs_val;
     }
+}
+
+void Golomb::encode_rice(unsigned int n, int k, int limit, int qbpp, BitStream& bs) {
+    unsigned int q = n >> k;
+    unsigned int max_q = static_cast<unsigned int>(limit - qbpp - 1);
+
+    if (q < max_q) {
+        for (unsigned int i = 0; i < q; ++i) {
+            bs.write_bit(0);
+        }
+        bs.write_bit(1);
+        if (k > 0) {
+            bs.write_n_bits(static_cast<uint64_t>(n & ((1u << k) - 1)), k);
+        }
+    } else {
+        for (unsigned int i = 0; i < max_q; ++i) {
+            bs.write_bit(0);
+        }
+        bs.write_bit(1);
+        bs.write_n_bits(static_cast<uint64_t>(n - 1), qbpp);
+    }
+}
+
+unsigned int Golomb::decode_rice(int k, int limit, int qbpp, BitStream& bs) {
+    unsigned int max_q = static_cast<unsigned int>(limit - qbpp - 1);
+    unsigned int q = 0;
+    int bit;
+
+    while ((bit = bs.read_bit()) == 0) {
+        q++;
+        if (q > max_q) {
+            throw std::runtime_error("Código Golomb-Rice inválido");
+        }
+    }
+    if (bit == EOF) {
+        throw std::runtime_error("EOF atingido ao ler código Golomb-Rice");
+    }
+
+    if (q < max_q) {
+        unsigned int r = (k > 0) ? static_cast<unsigned int>(bs.read_n_bits(k)) : 0;
+        return (q << k) | r;
+    }
+    return static_cast<unsigned int>(bs.read_n_bits(qbpp)) + 1;
 }
\ No newline at end of file
@@ -42,6 +42,12 @@ public:
     void encode(int n, BitStream& bs);
 
     int decode(BitStream& bs);
+
+    // Length-limited Golomb-Rice code (m = 2^k) for non-negative values, as
+    // used by JPEG-LS: quotients that would exceed 'limit' bits escape to a
+    // unary prefix followed by n - 1 written in 'qbpp' bits.
+    static void encode_rice(unsigned int n, int k, int limit, int qbpp, BitStream& bs);
+    static unsigned int decode_rice(int k, int limit, int qbpp, BitStream& bs);
 };
 
 #endif
\ No newline at end of file
@@ -1,23 +1,56 @@
 #include "image_codec.h"
+#include "context_model.h"
+#include "binary_coder.h"
+#include "predictors.h"
+#include "wavelet.h"
+#include "weighted_predictor.h"
 #include <iostream>
 #include <stdexcept>
 #include <numeric>
 #include <cmath>
 #include <algorithm>
+#include <array>
 #include <cstring>
-#include <opencv2/imgproc.hpp>
+#include <cstddef>
+#include <cstdio>
+#include <cctype>
+#include <bit>
 #include <filesystem>
 #include <iomanip>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <limits>
 
-ImageCodec::ImageCodec(std::string in_file, std::string out_file, int m, bool adaptive)
-    : m_in_file(in_file), m_out_file(out_file), m_fixed_m(m), m_adaptive(adaptive) {
-    if (!adaptive && m <= 0) {
+ImageCodec::ImageCodec(std::string in_file, std::string out_file, int m, bool adaptive,
+                       CodingMode mode, int near, bool online_k, bool row_streams)
+    : m_in_file(in_file), m_out_file(out_file), m_fixed_m(m), m_adaptive(adaptive), m_online_k(online_k),
+      m_row_streams(row_streams), m_mode(mode), m_maxval(255), m_near(near), m_thumbnail_scale(1), m_threads(1) {
+    if (mode != CodingMode::CONTEXT && !adaptive && m <= 0) {
         throw std::invalid_argument("Fixed 'm' must be > 0.");
     }
+    if (near < 0 || near > 255) {
+        throw std::invalid_argument("NEAR must be in [0, 255].");
+    }
+    if (online_k && mode != CodingMode::BLOCK_MED && mode != CodingMode::BLOCK_SELECT) {
+        throw std::invalid_argument("Online k is only available in the block modes.");
+    }
+    if (row_streams && mode != CodingMode::BLOCK_MED && mode != CodingMode::BLOCK_SELECT) {
+        throw std::invalid_argument("Row streams are only available in the block modes.");
+    }
+    if (near > 0 && mode == CodingMode::WAVELET) {
+        throw std::invalid_argument("NEAR is not supported in wavelet mode.");
+    }
 }
 
-ImageCodec::ImageCodec(std::string in_file, std::string out_file)
-    : m_in_file(in_file), m_out_file(out_file), m_fixed_m(1), m_adaptive(false) {
+ImageCodec::ImageCodec(std::string in_file, std::string out_file, int thumbnail_scale, int threads)
+    : m_in_file(in_file), m_out_file(out_file), m_fixed_m(1), m_adaptive(false), m_online_k(false),
+      m_row_streams(false), m_mode(CodingMode::BLOCK_MED), m_maxval(255), m_near(0),
+      m_thumbnail_scale(thumbnail_scale), m_threads(threads) {
+    if (thumbnail_scale < 1 || (thumbnail_scale & (thumbnail_scale - 1)) != 0) {
+        throw std::invalid_argument("Thumbnail scale must be a power of two.");
+    }
 }
 
 void ImageCodec::write_codec_header(const CodecHeader& header, std::fstream& fs) {
@@ -26,13 +59,59 @@ void ImageCodec::write_codec_header(const CodecHeader& header, std::fstream& fs)
 
 CodecHeader ImageCodec::read_codec_header(std::fstream& fs) {
     CodecHeader header;
-    fs.read(reinterpret_cast<char*>(&header), sizeof(CodecHeader));
-    if (fs.gcount() != sizeof(CodecHeader)) {
+    const std::streamsize v1_size = offsetof(CodecHeader, mode);
+    fs.read(reinterpret_cast<char*>(&header), v1_size);
+    if (fs.gcount() != v1_size) {
         throw std::runtime_error("Failed to read codec header.");
     }
     if (strncmp(header.magic, "GICL", 4) != 0) {
         throw std::runtime_error("Invalid file format must be  GICL.");
     }
+
+    // Version 1 files end here and only know the block MED mode.
+    if (header.version == 1) {
+        header.mode = static_cast<uint8_t>(CodingMode::BLOCK_MED);
+        header.bit_depth = 8;
+        header.maxval = 255;
+        return header;
+    }
+    // Older files stop before the fields they do not know: version 2 before
+    // the bit depth (8-bit only), version 3 before maxval (taken as the full
+    // range of the container, as those decoders wrote it), version 4 before
+    // NEAR, version 5 before the palette flag, version 6 before online k and
+    // version 7 before the row streams.
+    std::streamsize header_size = sizeof(CodecHeader);
+    bool from_depth = false;
+    if (header.version == 2) {
+        header.bit_depth = 8;
+        header.maxval = 255;
+        header_size = offsetof(CodecHeader, bit_depth);
+    } else if (header.version == 3) {
+        from_depth = true;
+        header_size = offsetof(CodecHeader, maxval);
+    } else if (header.version == 4) {
+        header.near = 0;
+        header.palette = false;
+        header_size = offsetof(CodecHeader, near);
+    } else if (header.version == 5) {
+        header.palette = false;
+        header_size = offsetof(CodecHeader, palette);
+    } else if (header.version == 6) {
+        header_size = offsetof(CodecHeader, online_k);
+    } else if (header.version == 7) {
+        header_size = offsetof(CodecHeader, row_streams);
+    } else if (header.version != CodecHeader().version) {
+        throw std::runtime_error("Unsupported GICL version: " + std::to_string(header.version));
+    }
+
+    const std::streamsize rest = header_size - v1_size;
+    fs.read(reinterpret_cast<char*>(&header) + v1_size, rest);
+    if (fs.gcount() != rest) {
+        throw std::runtime_error("Failed to read codec header.");
+    }
+    if (from_depth) {
+        header.maxval = (header.bit_depth > 8) ? 65535 : 255;
+    }
     return header;
 }
 
@@ -46,14 +125,26 @@ int ImageCodec::calculate_m(const std::vector<int>& residuals) {
     double avg = sum_abs / residuals.size();
 
     int m = static_cast<int>(std::round(avg * 0.693147));
-    return std::max(1, m);
+    return std::clamp(m, 1, 65535);
 }
 
-int ImageCodec::get_pixel(const cv::Mat& img, int r, int c) {
+template <typename T>
+int ImageCodec::get_pixel(const Image& img, int r, int c) {
     if (r < 0 || c < 0) {
         return 0;
     }
-    return (int)img.at<uint8_t>(r, c);
+    return (int)img.at<T>(r, c);
+}
+
+int ImageCodec::quantize_residual(int residual) {
+    // Uniform quantization with step 2 * near + 1 (JPEG-LS NEAR), so the
+    // reconstruction is always within +-near of the original sample.
+    if (residual > 0) return (m_near + residual) / (2 * m_near + 1);
+    return -((m_near - residual) / (2 * m_near + 1));
+}
+
+int ImageCodec::reconstruct_sample(int prediction, int residual) {
+    return std::clamp(prediction + residual * (2 * m_near + 1), 0, m_maxval);
 }
 
 int ImageCodec::predict(int A, int B, int C) {
@@ -67,55 +158,220 @@ int ImageCodec::predict(int A, int B, int C) {
 }
 
 
-void ImageCodec::encode() {
-    std::cout << "Encoding " << m_in_file << " to " << m_out_file << "...\n";
-    std::cout << "Mode: " << (m_adaptive ? "Adaptive 'm'" : "Fixed 'm' = " + std::to_string(m_fixed_m)) << "\n";
+template <typename T>
+void ImageCodec::print_distortion(const Image& original, const Image& decoded) {
+    double sse = 0.0;
+    int max_err = 0;
+    for (int r = 0; r < original.rows; ++r) {
+        const T* a = original.ptr<T>(r);
+        const T* b = decoded.ptr<T>(r);
+        for (int c = 0; c < original.cols; ++c) {
+            int e = static_cast<int>(a[c]) - static_cast<int>(b[c]);
+            sse += static_cast<double>(e) * e;
+            max_err = std::max(max_err, std::abs(e));
+        }
+    }
+
+    double mse = sse / (static_cast<double>(original.rows) * original.cols);
+    std::cout << "Max abs error:   " << max_err << "\n";
+    if (mse == 0.0) {
+        std::cout << "PSNR:            inf dB\n";
+    } else {
+        double peak = static_cast<double>(m_maxval);
+        std::cout << "PSNR:            " << std::fixed << std::setprecision(2)
+                  << 10.0 * std::log10(peak * peak / mse) << " dB\n";
+    }
+}
 
-    cv::Mat img = cv::imread(m_in_file, cv::IMREAD_GRAYSCALE);
-    if (!img.data) {
-        throw std::runtime_error("Could not load image: " + m_in_file);
+void ImageCodec::print_mode(CodingMode mode, bool adaptive, int fixed_m, bool online_k) {
+    if (online_k) {
+        std::cout << "Mode: " << (mode == CodingMode::BLOCK_SELECT ? "Per-block predictor selection" : "MED")
+                  << ", online Golomb-Rice k (no side info)\n";
+        return;
     }
-    if (img.type() != CV_8U) {
-        throw std::runtime_error("Only 8-bit grayscale images are supported.");
+    switch (mode) {
+        case CodingMode::CONTEXT:
+            std::cout << "Mode: Context modeling (LOCO-I) with run mode\n";
+            break;
+        case CodingMode::BILEVEL:
+            std::cout << "Mode: Bilevel context modeling (JBIG-like)\n";
+            break;
+        case CodingMode::PROGRESSIVE:
+            std::cout << "Mode: Resolution-progressive, "
+                      << (adaptive ? "adaptive 'm'" : "fixed 'm' = " + std::to_string(fixed_m)) << "\n";
+            break;
+        case CodingMode::SEQUENCE:
+            std::cout << "Mode: Frame sequence (spatial/temporal prediction per block), "
+                      << (adaptive ? "adaptive 'm'" : "fixed 'm' = " + std::to_string(fixed_m)) << "\n";
+            break;
+        case CodingMode::QUADTREE:
+            std::cout << "Mode: Quadtree blocks with per-leaf predictor and Rice parameter\n";
+            break;
+        case CodingMode::WEIGHTED:
+            std::cout << "Mode: Self-correcting weighted predictor, online Golomb-Rice k\n";
+            break;
+        case CodingMode::WAVELET:
+            std::cout << "Mode: 5/3 wavelet, "
+                      << (adaptive ? "adaptive 'm' per subband" : "fixed 'm' = " + std::to_string(fixed_m)) << "\n";
+            break;
+        case CodingMode::BLOCK_SELECT:
+            std::cout << "Mode: Per-block predictor selection, "
+                      << (adaptive ? "adaptive 'm'" : "fixed 'm' = " + std::to_string(fixed_m)) << "\n";
+            break;
+        default:
+            std::cout << "Mode: " << (adaptive ? "Adaptive 'm'" : "Fixed 'm' = " + std::to_string(fixed_m)) << "\n";
+            break;
     }
-    std::cout << "Input: " << img.cols << "x" << img.rows << ", 8-bit grayscale\n";
+}
 
-    std::fstream out_fs(m_out_file, std::ios::out | std::ios::binary);
-    if (!out_fs) {
-        throw std::runtime_error("Failed to create output file.");
+template <typename T>
+void ImageCodec::context_neighbours(const Image& img, int r, int c,
+                                    int& a, int& b, int& c_, int& d) {
+    // Edge rules follow JPEG-LS: the first row sees zeros above it, the
+    // first column reuses the sample above as its left neighbour and the
+    // last column repeats the upper sample as the upper-right one.
+    if (r == 0) {
+        a = (c > 0) ? img.at<T>(0, c - 1) : 0;
+        b = c_ = d = 0;
+        return;
     }
 
-    CodecHeader codec_h;
-    codec_h.width = img.cols;
-    codec_h.height = img.rows;
-    codec_h.adaptive = m_adaptive;
-    codec_h.fixed_m = static_cast<uint16_t>(m_fixed_m);
-    write_codec_header(codec_h, out_fs);
+    const T* up = img.ptr<T>(r - 1);
+    b = up[c];
+    d = (c + 1 < img.cols) ? up[c + 1] : b;
+    if (c == 0) {
+        a = b;
+        c_ = (r > 1) ? img.at<T>(r - 2, 0) : 0;
+    } else {
+        a = img.at<T>(r, c - 1);
+        c_ = up[c - 1];
+    }
+}
 
-    int num_blocks = (img.rows + BLOCK_SIZE_Y - 1) / BLOCK_SIZE_Y;
-    std::vector<std::vector<int>> blocks_residuals(num_blocks);
+template <typename T>
+static Neighbourhood neighbourhood(const Image& img, int r, int c) {
+    auto px = [&img](int y, int x) {
+        return (y < 0 || x < 0 || x >= img.cols) ? 0 : (int)img.at<T>(y, x);
+    };
+    return { px(r, c - 1), px(r - 1, c), px(r - 1, c - 1), px(r - 1, c + 1),
+             px(r, c - 2), px(r - 2, c), px(r - 2, c + 1) };
+}
 
-    for (int r = 0; r < img.rows; ++r) {
-        int block_idx = r / BLOCK_SIZE_Y;
-        for (int c = 0; c < img.cols; ++c) {
-            int A = get_pixel(img, r, c - 1);
-            int B = get_pixel(img, r - 1, c);
-            int C = get_pixel(img, r - 1, c - 1);
+template <typename T>
+int ImageCodec::choose_predictor(const Image& img, int r0, int r1) {
+    // Copy the block and the two rows above it into zero-padded int rows,
+    // then score all the predictors in one branch-free pass per row.
+    const int pad = 2;
+    const int width = img.cols + 2 * pad;
+    std::vector<int> plane(static_cast<size_t>(r1 - r0 + 2) * width, 0);
+    for (int r = std::max(0, r0 - 2); r < r1; ++r) {
+        const T* src = img.ptr<T>(r);
+        int* dst = &plane[static_cast<size_t>(r - r0 + 2) * width + pad];
+        std::copy(src, src + img.cols, dst);
+    }
 
-            int P = predict(A, B, C);
-            
-            int X = (int)img.at<uint8_t>(r, c);
-            int residual = X - P;
+    long costs[NUM_PREDICTORS] = {};
+    for (int r = r0; r < r1; ++r) {
+        const int* cur = &plane[static_cast<size_t>(r - r0 + 2) * width + pad];
+        row_costs(cur, cur - width, cur - 2 * width, img.cols, m_maxval, costs);
+    }
+    return static_cast<int>(std::min_element(costs, costs + NUM_PREDICTORS) - costs);
+}
 
-            blocks_residuals[block_idx].push_back(residual);
-        }
+// Side-info-free Golomb-Rice parameter for the block modes: k follows the
+// magnitudes of the residuals already coded at W, NW, N and NE, so the
+// encoder and the decoder derive the same k and no 'm' is sent.
+//
+// The magnitudes live in rows of cols + 2 ints (one zero sample of padding
+// on each side) owned by the caller: 'prev' for the row above, 'cur' for
+// the row being coded.
+class OnlineRice {
+public:
+    explicit OnlineRice(int bit_depth)
+        : m_qbpp(bit_depth + 1), m_limit(2 * (m_qbpp + std::max(8, m_qbpp))) {}
+
+    void encode(int residual, const int* prev, int* cur, int c, BitStream& bs) const {
+        unsigned mapped = (residual >= 0) ? 2u * residual : -2u * residual - 1u;
+        Golomb::encode_rice(mapped, k(prev, cur, c), m_limit, m_qbpp, bs);
+        cur[c + 1] = std::abs(residual);
+    }
+
+    int decode(const int* prev, int* cur, int c, BitStream& bs) const {
+        unsigned mapped = Golomb::decode_rice(k(prev, cur, c), m_limit, m_qbpp, bs);
+        int residual = (mapped & 1) ? -static_cast<int>((mapped + 1) / 2) : static_cast<int>(mapped / 2);
+        cur[c + 1] = std::abs(residual);
+        return residual;
+    }
+
+private:
+    // Smallest k with 2^k >= 5/16 * (|eW| + |eNW| + |eN| + |eNE|), i.e. a
+    // bit over half the local mean magnitude (the interleaved values are
+    // twice as large, and Rice codes favour k below their mean). The 5/16
+    // scale was tuned on the test images.
+    static int k(const int* prev, const int* cur, int c) {
+        int a = 5 * (cur[c] + prev[c] + prev[c + 1] + prev[c + 2]);
+        return std::bit_width(static_cast<unsigned>(std::max(a, 1) - 1) >> 4);
+    }
+
+    int m_qbpp;
+    int m_limit;
+};
+
+template <typename T>
+void ImageCodec::encode_blocks(Image& img, BitStream& bs, bool select_predictor) {
+    if (m_row_streams) {
+        encode_rows<T>(img, bs, select_predictor);
+        return;
     }
 
-    BitStream bs(out_fs, STREAM_WRITE);
     int initial_m = m_adaptive ? 1 : m_fixed_m;
     Golomb golomb(initial_m, NegativeHandling::INTERLEAVING);
+    std::vector<int> block;
+    OnlineRice online(std::bit_width(static_cast<unsigned>(m_maxval)));
+    std::vector<int> prev_mag(img.cols + 2, 0), cur_mag(img.cols + 2, 0);
+
+    // Bands of BLOCK_SIZE_Y rows are predicted and coded as soon as their
+    // rows are available, so a streamed input overlaps with the coding.
+    for (int r0 = 0; r0 < img.rows; r0 += BLOCK_SIZE_Y) {
+        int r1 = std::min(r0 + BLOCK_SIZE_Y, img.rows);
+        wait_rows(r1);
+
+        int predictor = select_predictor ? choose_predictor<T>(img, r0, r1) : PRED_MED;
+        if (select_predictor) {
+            bs.write_n_bits(static_cast<uint64_t>(predictor), PREDICTOR_BITS);
+        }
+
+        block.clear();
+        for (int r = r0; r < r1; ++r) {
+            for (int c = 0; c < img.cols; ++c) {
+                int P;
+                if (select_predictor) {
+                    P = predict_with(predictor, neighbourhood<T>(img, r, c), m_maxval);
+                } else {
+                    int A = get_pixel<T>(img, r, c - 1);
+                    int B = get_pixel<T>(img, r - 1, c);
+                    int C = get_pixel<T>(img, r - 1, c - 1);
+
+                    P = predict(A, B, C);
+                }
+                
+                int X = (int)img.at<T>(r, c);
+                int residual = X - P;
+                if (m_near > 0) {
+                    residual = quantize_residual(residual);
+                    img.at<T>(r, c) = static_cast<T>(reconstruct_sample(P, residual));
+                }
+
+                if (m_online_k) {
+                    online.encode(residual, prev_mag.data(), cur_mag.data(), c, bs);
+                } else {
+                    block.push_back(residual);
+                }
+            }
+            std::swap(prev_mag, cur_mag);
+        }
 
-    for (const auto& block : blocks_residuals) {
+        if (m_online_k) continue;
         if (m_adaptive) {
             int m = calculate_m(block);
             bs.write_n_bits(static_cast<uint64_t>(m), 16);
@@ -126,86 +382,1675 @@ void ImageCodec::encode() {
             golomb.encode(residual, bs);
         }
     }
+}
 
-    bs.close();
-    out_fs.close();
-    std::cout << "Encoding complete.\n";
+// Row-stream layout of the block modes, for wavefront-parallel decoding:
+//
+//   [one predictor byte per band, -p only] [32-bit byte size of every row]
+//   [row 0] [row 1] ...
+//
+// Each row is a byte-aligned substream holding its own 'm' (adaptive), or
+// nothing (fixed 'm', online k), followed by its residuals. The sizes are
+// patched in once the rows have been written.
+template <typename T>
+void ImageCodec::encode_rows(Image& img, BitStream& bs, bool select_predictor) {
+    wait_rows(img.rows);
+    const int bands = (img.rows + BLOCK_SIZE_Y - 1) / BLOCK_SIZE_Y;
+    std::vector<int> predictors(bands, PRED_MED);
 
-    try {
-        uintmax_t in_file_size = std::filesystem::file_size(m_in_file);
-        uintmax_t out_file_size = std::filesystem::file_size(m_out_file);
+    bs.align();
+    if (select_predictor) {
+        for (int b = 0; b < bands; ++b) {
+            predictors[b] = choose_predictor<T>(img, b * BLOCK_SIZE_Y, std::min((b + 1) * BLOCK_SIZE_Y, img.rows));
+            bs.write_n_bits(static_cast<uint64_t>(predictors[b]), 8);
+        }
+    }
+    // align() also pushes out a completed byte, so tell() is exact after it.
+    bs.align();
+    m_row_table_pos = bs.tell();
+    for (int r = 0; r < img.rows; ++r) {
+        bs.write_n_bits(0, 32);
+    }
+    bs.align();
 
-        if (out_file_size > 0) {
-            double compression_rate = static_cast<double>(in_file_size) / out_file_size;
-            
-            std::cout << "\n--- Compression Stats ---\n";
-            std::cout << "Original Size:   " << in_file_size << " bytes\n";
-            std::cout << "Compressed Size: " << out_file_size << " bytes\n";
-            std::cout << "Compression Rate: " << std::fixed << std::setprecision(2) << compression_rate << ":1\n";
+    Golomb golomb(m_adaptive ? 1 : m_fixed_m, NegativeHandling::INTERLEAVING);
+    OnlineRice online(std::bit_width(static_cast<unsigned>(m_maxval)));
+    std::vector<int> prev_mag(img.cols + 2, 0), cur_mag(img.cols + 2, 0);
+    std::vector<int> residuals(img.cols);
+    m_row_sizes.assign(img.rows, 0);
+
+    for (int r = 0; r < img.rows; ++r) {
+        off_t start = bs.tell();
+        int predictor = predictors[r / BLOCK_SIZE_Y];
+        for (int c = 0; c < img.cols; ++c) {
+            int P = predict_with(predictor, neighbourhood<T>(img, r, c), m_maxval);
+            int residual = static_cast<int>(img.at<T>(r, c)) - P;
+            if (m_near > 0) {
+                residual = quantize_residual(residual);
+                img.at<T>(r, c) = static_cast<T>(reconstruct_sample(P, residual));
+            }
+            residuals[c] = residual;
+        }
+
+        if (m_online_k) {
+            for (int c = 0; c < img.cols; ++c) {
+                online.encode(residuals[c], prev_mag.data(), cur_mag.data(), c, bs);
+            }
+            std::swap(prev_mag, cur_mag);
         } else {
-            std::cout << "\n--- Compression Stats ---\n";
-            std::cout << "Original Size:   " << in_file_size << " bytes\n";
-            std::cout << "Compressed Size: 0 bytes (Error?)\n";
+            if (m_adaptive) {
+                int m = calculate_m(residuals);
+                bs.write_n_bits(static_cast<uint64_t>(m), 16);
+                golomb.set_m(m);
+            }
+            for (int residual : residuals) {
+                golomb.encode(residual, bs);
+            }
         }
-    } catch (std::filesystem::filesystem_error& e) {
-        std::cerr << "Could not get file sizes for stats: " << e.what() << std::endl;
+
+        bs.align();
+        m_row_sizes[r] = static_cast<uint32_t>(bs.tell() - start);
     }
 }
 
-void ImageCodec::decode() {
-    std::cout << "Decoding " << m_in_file << " to " << m_out_file << "...\n";
+void ImageCodec::patch_row_sizes() {
+    std::fstream fs(m_out_file, std::ios::in | std::ios::out | std::ios::binary);
+    if (!fs) {
+        throw std::runtime_error("Failed to reopen output file.");
+    }
+    std::vector<char> table;
+    table.reserve(m_row_sizes.size() * 4);
+    for (uint32_t size : m_row_sizes) {
+        for (int shift = 24; shift >= 0; shift -= 8) table.push_back(static_cast<char>(size >> shift));
+    }
+    fs.seekp(static_cast<std::streamoff>(sizeof(CodecHeader) + m_row_table_pos));
+    fs.write(table.data(), static_cast<std::streamsize>(table.size()));
+    if (!fs) {
+        throw std::runtime_error("Failed to write the row table.");
+    }
+}
 
-    std::fstream in_fs(m_in_file, std::ios::in | std::ios::binary);
-    if (!in_fs) {
-        throw std::runtime_error("Failed to open input file.");
+template <typename T>
+void ImageCodec::decode_rows(Image& img, const CodecHeader& header, BitStream& bs) {
+    const bool select_predictor = (static_cast<CodingMode>(header.mode) == CodingMode::BLOCK_SELECT);
+    const int bands = (img.rows + BLOCK_SIZE_Y - 1) / BLOCK_SIZE_Y;
+    std::vector<int> predictors(bands, PRED_MED);
+
+    bs.align();
+    if (select_predictor) {
+        for (int& p : predictors) {
+            p = static_cast<int>(bs.read_n_bits(8));
+            if (p >= NUM_PREDICTORS) {
+                throw std::runtime_error("Invalid predictor selector.");
+            }
+        }
     }
+    std::vector<uint64_t> offsets(img.rows);
+    uint64_t offset = 0;
+    for (int r = 0; r < img.rows; ++r) {
+        offsets[r] = offset;
+        offset += bs.read_n_bits(32);
+    }
+    const uint64_t base = sizeof(CodecHeader) + static_cast<uint64_t>(bs.tell());
 
-    CodecHeader codec_h = read_codec_header(in_fs);
-    std::cout << "Input: " << codec_h.width << "x" << codec_h.height << "\n";
-    std::cout << "Mode: " << (codec_h.adaptive ? "Adaptive 'm'" : "Fixed 'm' = " + std::to_string(codec_h.fixed_m)) << "\n";
+    int threads = m_threads > 0 ? m_threads : static_cast<int>(std::thread::hardware_concurrency());
+    threads = std::clamp(threads, 1, std::max(1, img.rows));
+    std::cout << "Wavefront decoding with " << threads << " thread" << (threads > 1 ? "s" : "") << "\n";
 
-    cv::Mat img = cv::Mat(codec_h.height, codec_h.width, CV_8U);
+    // Row r is decoded by thread r % threads. progress[r] counts the samples
+    // of row r already written; a pixel may be decoded once the row above
+    // has passed its NE neighbour, which also covers the residual
+    // magnitudes used by the online k.
+    const int cols = img.cols;
+    std::vector<std::atomic<int>> progress(img.rows);
+    const int RING = 4;
+    std::vector<int> magnitudes(static_cast<size_t>(RING + 1) * (cols + 2), 0);
+    auto mag_row = [&](int slot) { return magnitudes.data() + static_cast<size_t>(slot) * (cols + 2); };
 
-    BitStream bs(in_fs, STREAM_READ);
-    int initial_m = codec_h.adaptive ? 1 : codec_h.fixed_m;
-    Golomb golomb(initial_m, NegativeHandling::INTERLEAVING);
+    std::mutex error_mutex;
+    std::exception_ptr error;
+
+    auto worker = [&](int first_row) {
+        std::fstream fs(m_in_file, std::ios::in | std::ios::binary);
+        Golomb golomb(header.adaptive ? 1 : header.fixed_m, NegativeHandling::INTERLEAVING);
+        OnlineRice online(header.bit_depth);
+
+        for (int r = first_row; r < img.rows; r += threads) {
+            try {
+                fs.clear();
+                fs.seekg(static_cast<std::streamoff>(base + offsets[r]));
+                BitStream row_bs(fs, STREAM_READ);
+                if (!header.online_k && header.adaptive) {
+                    int m = static_cast<int>(row_bs.read_n_bits(16));
+                    golomb.set_m(m > 0 ? m : 1);
+                }
+
+                const int* prev = (r > 0) ? mag_row((r - 1) % RING) : mag_row(RING);  // last slot stays zero
+                int* cur = mag_row(r % RING);
+                int ready = (r > 0) ? 0 : cols;
+                int predictor = predictors[r / BLOCK_SIZE_Y];
+
+                for (int c = 0; c < cols; ++c) {
+                    int needed = std::min(cols, c + 2);
+                    while (ready < needed) {
+                        ready = progress[r - 1].load(std::memory_order_acquire);
+                        if (ready < needed) progress[r - 1].wait(ready, std::memory_order_acquire);
+                    }
+
+                    int P = predict_with(predictor, neighbourhood<T>(img, r, c), m_maxval);
+                    int residual = header.online_k ? online.decode(prev, cur, c, row_bs) : golomb.decode(row_bs);
+                    img.at<T>(r, c) = static_cast<T>(reconstruct_sample(P, residual));
+
+                    if ((c & (ROW_PROGRESS_STEP - 1)) == ROW_PROGRESS_STEP - 1) {
+                        progress[r].store(c + 1, std::memory_order_release);
+                        progress[r].notify_all();
+                    }
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error) error = std::current_exception();
+            }
+            // Also releases the rows below when this one failed.
+            progress[r].store(cols, std::memory_order_release);
+            progress[r].notify_all();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; ++t) {
+        pool.emplace_back(worker, t);
+    }
+    worker(0);
+    for (std::thread& thread : pool) {
+        thread.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+template <typename T>
+int ImageCodec::encode_run(Image& img, int r, int c, ContextModel& model, BitStream& bs) {
+    T* row = img.ptr<T>(r);
+    int run_val = (c > 0) ? row[c - 1] : ((r > 0) ? img.at<T>(r - 1, 0) : 0);
+
+    int count = 0;
+    while (c + count < img.cols && std::abs(static_cast<int>(row[c + count]) - run_val) <= m_near) count++;
+    bool end_of_line = (c + count == img.cols);
+    if (m_near > 0) {
+        std::fill(row + c, row + c + count, static_cast<T>(run_val));
+    }
+
+    int remaining = count;
+    while (remaining >= (1 << model.run_k())) {
+        bs.write_bit(1);
+        remaining -= 1 << model.run_k();
+        model.run_hit();
+    }
+
+    c += count;
+    if (end_of_line) {
+        if (remaining > 0) bs.write_bit(1);
+        return c;
+    }
+
+    bs.write_bit(0);
+    if (model.run_k() > 0) {
+        bs.write_n_bits(static_cast<uint64_t>(remaining), model.run_k());
+    }
+
+    // Run interruption sample
+    int a, b, c_, d;
+    context_neighbours<T>(img, r, c, a, b, c_, d);
+    int ritype = (std::abs(a - b) <= m_near) ? 1 : 0;
+    int px = ritype ? a : b;
+    int sign = (ritype == 0 && a > b) ? -1 : 1;
+    int errval = sign * (static_cast<int>(row[c]) - px);
+    errval = model.reduce(model.quantize_error(errval));
+
+    int k = model.ri_k(ritype);
+    int emerrval = model.ri_map_error(ritype, k, errval);
+    Golomb::encode_rice(emerrval, k, model.ri_limit(), model.qbpp(), bs);
+    model.ri_update(ritype, errval, emerrval);
+    model.run_miss();
+
+    if (m_near > 0) {
+        row[c] = static_cast<T>(model.reconstruct(px, sign * errval));
+    }
+    return c + 1;
+}
+
+template <typename T>
+void ImageCodec::encode_context(Image& img, BitStream& bs) {
+    ContextModel model(m_maxval, m_near);
+
+    for (int r = 0; r < img.rows; ++r) {
+        T* row = img.ptr<T>(r);
+        int c = 0;
+        while (c < img.cols) {
+            int a, b, c_, d;
+            context_neighbours<T>(img, r, c, a, b, c_, d);
+
+            int sign;
+            int q = model.context(a, b, c_, d, sign);
+            if (q == ContextModel::RUN_CONTEXT) {
+                c = encode_run<T>(img, r, c, model, bs);
+                continue;
+            }
+            int px = model.predict(q, sign, a, b, c_);
+
+            int errval = sign * (static_cast<int>(row[c]) - px);
+            errval = model.reduce(model.quantize_error(errval));
+
+            int k = model.k(q);
+            Golomb::encode_rice(model.map_error(q, k, errval), k, model.limit(), model.qbpp(), bs);
+            model.update(q, errval);
+
+            // Later predictions must see what the decoder will reconstruct.
+            if (m_near > 0) {
+                row[c] = static_cast<T>(model.reconstruct(px, sign * errval));
+            }
+            c++;
+        }
+    }
+}
+
+template <typename T>
+int ImageCodec::count_levels(const Image& img, int levels[2]) {
+    std::vector<bool> seen(m_maxval + 1, false);
+    int count = 0;
+    for (int r = 0; r < img.rows; ++r) {
+        const T* row = img.ptr<T>(r);
+        for (int c = 0; c < img.cols; ++c) {
+            if (!seen[row[c]]) {
+                seen[row[c]] = true;
+                if (count < 2) levels[count] = row[c];
+                if (++count > 2) return count;
+            }
+        }
+    }
+    if (count == 1) levels[1] = levels[0];
+    if (levels[0] > levels[1]) std::swap(levels[0], levels[1]);
+    return count;
+}
+
+// JBIG-style context of the current binary pixel: three pixels of the row
+// two above, five of the row above and the two previous ones (10 bits).
+static inline int bilevel_context(const uint8_t* up2, const uint8_t* up1, const uint8_t* cur, int x) {
+    return (up2[x - 1] << 9) | (up2[x] << 8) | (up2[x + 1] << 7) |
+           (up1[x - 2] << 6) | (up1[x - 1] << 5) | (up1[x] << 4) | (up1[x + 1] << 3) | (up1[x + 2] << 2) |
+           (cur[x - 2] << 1) | cur[x - 1];
+}
+
+template <typename T>
+void ImageCodec::encode_bilevel(const Image& img, const int levels[2], BitStream& bs) {
+    bs.write_n_bits(static_cast<uint64_t>(levels[0]), 16);
+    bs.write_n_bits(static_cast<uint64_t>(levels[1]), 16);
+
+    BinaryEncoder coder(bs);
+    std::vector<uint16_t> probs(1 << BILEVEL_CONTEXT_BITS, BINARY_PROB_INIT);
+    uint16_t same_row_prob = BINARY_PROB_INIT;
+
+    // Rows are padded by two zero pixels on each side so the template never
+    // needs bounds checks.
+    const int pad = 2;
+    std::vector<uint8_t> lines[3];
+    for (auto& line : lines) line.assign(img.cols + 2 * pad, 0);
 
     for (int r = 0; r < img.rows; ++r) {
-        if (codec_h.adaptive && (r % BLOCK_SIZE_Y == 0)) {
+        std::vector<uint8_t>& cur = lines[r % 3];
+        const std::vector<uint8_t>& up1 = lines[(r + 2) % 3];
+        const std::vector<uint8_t>& up2 = lines[(r + 1) % 3];
+
+        const T* row = img.ptr<T>(r);
+        for (int c = 0; c < img.cols; ++c) {
+            cur[c + pad] = (row[c] == levels[1] && levels[1] != levels[0]) ? 1 : 0;
+        }
+
+        // Typical prediction: a row equal to the previous one costs one bit.
+        bool same = std::equal(cur.begin(), cur.end(), up1.begin());
+        coder.encode(same ? 1 : 0, same_row_prob);
+        if (same) continue;
+
+        for (int c = 0; c < img.cols; ++c) {
+            int ctx = bilevel_context(up2.data() + pad, up1.data() + pad, cur.data() + pad, c);
+            coder.encode(cur[c + pad], probs[ctx]);
+        }
+    }
+    coder.finish();
+}
+
+// Resolution-progressive passes. Pass 0 codes the samples on the coarsest
+// grid (step 2^levels) with MED over that grid. Each following level with
+// step s adds the centres of the 2s-grid cells (pass 2l - 1), interpolated
+// from their four diagonal corners, and then the remaining edge samples
+// (pass 2l), interpolated from their four orthogonal neighbours. After pass
+// 2l the image is complete on the grid of step 2^(levels - l).
+static int progressive_step_after(int levels, int pass) {
+    return 1 << (levels - pass / 2);
+}
+
+template <typename T, typename Visit>
+static void progressive_pass(Image& img, int levels, int pass, Visit&& visit) {
+    auto at = [&img](int r, int c) { return static_cast<int>(img.at<T>(r, c)); };
+    auto inside = [&img](int r, int c) { return r >= 0 && c >= 0 && r < img.rows && c < img.cols; };
+
+    if (pass == 0) {
+        const int s = 1 << levels;
+        for (int r = 0; r < img.rows; r += s) {
+            for (int c = 0; c < img.cols; c += s) {
+                int A = (c >= s) ? at(r, c - s) : 0;
+                int B = (r >= s) ? at(r - s, c) : 0;
+                int C = (r >= s && c >= s) ? at(r - s, c - s) : 0;
+                int P;
+                if (C >= std::max(A, B)) P = std::min(A, B);
+                else if (C <= std::min(A, B)) P = std::max(A, B);
+                else P = A + B - C;
+                visit(r, c, P);
+            }
+        }
+        return;
+    }
+
+    const int s = 1 << (levels - (pass + 1) / 2);
+    const bool centres = (pass % 2 == 1);
+
+    for (int r = 0; r < img.rows; r += s) {
+        bool odd_r = (r / s) % 2 == 1;
+        if (centres && !odd_r) continue;
+        for (int c = centres ? s : 0; c < img.cols; c += centres ? 2 * s : s) {
+            bool odd_c = (c / s) % 2 == 1;
+            int n1, n2, n3, n4;  // two pairs of opposite neighbours
+            bool h1, h2, h3, h4;
+            if (centres) {
+                n1 = inside(r - s, c - s) ? at(r - s, c - s) : 0; h1 = inside(r - s, c - s);
+                n2 = inside(r + s, c + s) ? at(r + s, c + s) : 0; h2 = inside(r + s, c + s);
+                n3 = inside(r - s, c + s) ? at(r - s, c + s) : 0; h3 = inside(r - s, c + s);
+                n4 = inside(r + s, c - s) ? at(r + s, c - s) : 0; h4 = inside(r + s, c - s);
+            } else {
+                if (odd_r == odd_c) continue;
+                n1 = inside(r, c - s) ? at(r, c - s) : 0; h1 = inside(r, c - s);
+                n2 = inside(r, c + s) ? at(r, c + s) : 0; h2 = inside(r, c + s);
+                n3 = inside(r - s, c) ? at(r - s, c) : 0; h3 = inside(r - s, c);
+                n4 = inside(r + s, c) ? at(r + s, c) : 0; h4 = inside(r + s, c);
+            }
+
+            int P;
+            if (h1 && h2 && h3 && h4) {
+                // Interpolate along the direction with the smaller gradient.
+                int g1 = std::abs(n1 - n2);
+                int g2 = std::abs(n3 - n4);
+                if (g1 < g2) P = (n1 + n2 + 1) >> 1;
+                else if (g2 < g1) P = (n3 + n4 + 1) >> 1;
+                else P = (n1 + n2 + n3 + n4 + 2) >> 2;
+            } else {
+                int count = h1 + h2 + h3 + h4;
+                P = (n1 + n2 + n3 + n4 + count / 2) / count;
+            }
+            visit(r, c, P);
+        }
+    }
+}
+
+template <typename T>
+void ImageCodec::encode_progressive(Image& img, BitStream& bs) {
+    bs.write_n_bits(static_cast<uint64_t>(PROGRESSIVE_LEVELS), 4);
+
+    Golomb golomb(m_adaptive ? 1 : m_fixed_m, NegativeHandling::INTERLEAVING);
+    int num_passes = 2 * PROGRESSIVE_LEVELS + 1;
+
+    for (int pass = 0; pass < num_passes; ++pass) {
+        std::vector<int> residuals;
+        progressive_pass<T>(img, PROGRESSIVE_LEVELS, pass, [&](int r, int c, int P) {
+            int residual = static_cast<int>(img.at<T>(r, c)) - P;
+            if (m_near > 0) {
+                residual = quantize_residual(residual);
+                img.at<T>(r, c) = static_cast<T>(reconstruct_sample(P, residual));
+            }
+            residuals.push_back(residual);
+        });
+
+        if (m_adaptive) {
+            int m = calculate_m(residuals);
+            bs.write_n_bits(static_cast<uint64_t>(m), 16);
+            golomb.set_m(m);
+        }
+        for (int residual : residuals) {
+            golomb.encode(residual, bs);
+        }
+    }
+}
+
+template <typename T>
+void ImageCodec::decode_progressive(Image& img, const CodecHeader& header, BitStream& bs) {
+    int levels = static_cast<int>(bs.read_n_bits(4));
+    Golomb golomb(header.adaptive ? 1 : header.fixed_m, NegativeHandling::INTERLEAVING);
+    int num_passes = 2 * levels + 1;
+
+    for (int pass = 0; pass < num_passes; ++pass) {
+        if (header.adaptive) {
             int m = static_cast<int>(bs.read_n_bits(16));
             if (m <= 0) m = 1;
             golomb.set_m(m);
         }
 
-        for (int c = 0; c < img.cols; ++c) {
-            int A = get_pixel(img, r, c - 1);
-            int B = get_pixel(img, r - 1, c);
-            int C = get_pixel(img, r - 1, c - 1);
+        progressive_pass<T>(img, levels, pass, [&](int r, int c, int P) {
+            img.at<T>(r, c) = static_cast<T>(reconstruct_sample(P, golomb.decode(bs)));
+        });
+
+        // Stop as soon as the grid needed for the requested thumbnail is
+        // complete; the remaining passes are never read.
+        if (progressive_step_after(levels, pass) <= m_thumbnail_scale) {
+            m_decoded_scale = progressive_step_after(levels, pass);
+            break;
+        }
+    }
+}
 
-            int P = predict(A, B, C);
+// Subbands in coding order: the coarsest LL first, then HL, LH and HH from
+// the coarsest level to the finest, so a decoder can stop after any level.
+// Each band is a rectangle [r0, r1) x [c0, c1) of the Mallat layout.
+struct Subband {
+    int level, r0, r1, c0, c1;
+};
 
-            int residual = golomb.decode(bs);
+static std::vector<Subband> wavelet_subbands(int rows, int cols, int levels) {
+    std::vector<Subband> bands;
+    bands.push_back({levels, 0, wavelet_size(rows, levels), 0, wavelet_size(cols, levels)});
+    for (int l = levels; l >= 1; --l) {
+        int h = wavelet_size(rows, l), w = wavelet_size(cols, l);
+        int hp = wavelet_size(rows, l - 1), wp = wavelet_size(cols, l - 1);
+        bands.push_back({l, 0, h, w, wp});    // HL
+        bands.push_back({l, h, hp, 0, w});    // LH
+        bands.push_back({l, h, hp, w, wp});   // HH
+    }
+    return bands;
+}
+
+// Interleaving maps a coefficient v to about 2|v|, and the subbands are
+// sharply peaked at zero, so 'm' follows the mean of the mapped values.
+static int subband_m(const std::vector<int>& values) {
+    if (values.empty()) return 1;
+
+    double sum_abs = 0.0;
+    for (int v : values) {
+        sum_abs += std::abs(static_cast<double>(v));
+    }
+    double avg = 2.0 * sum_abs / values.size();
+
+    int m = static_cast<int>(std::round(avg * 0.693147));
+    return std::clamp(m, 1, 65535);
+}
+
+template <typename T>
+void ImageCodec::encode_wavelet(const Image& img, BitStream& bs) {
+    int levels = 0;
+    while (levels < WAVELET_LEVELS && wavelet_size(img.rows, levels) >= 16 && wavelet_size(img.cols, levels) >= 16) {
+        levels++;
+    }
+    bs.write_n_bits(static_cast<uint64_t>(levels), 4);
+
+    std::vector<int32_t> plane(static_cast<size_t>(img.rows) * img.cols);
+    for (int r = 0; r < img.rows; ++r) {
+        const T* row = img.ptr<T>(r);
+        std::copy(row, row + img.cols, plane.begin() + static_cast<size_t>(r) * img.cols);
+    }
+    dwt53_forward(plane.data(), img.rows, img.cols, levels);
 
-            int X = residual + P;
+    auto coeff = [&](int r, int c) { return plane[static_cast<size_t>(r) * img.cols + c]; };
+    Golomb golomb(m_adaptive ? 1 : m_fixed_m, NegativeHandling::INTERLEAVING);
+    std::vector<int> values;
+
+    for (const Subband& band : wavelet_subbands(img.rows, img.cols, levels)) {
+        values.clear();
+        bool ll = (band.r0 == 0 && band.c0 == 0);
+        for (int r = band.r0; r < band.r1; ++r) {
+            for (int c = band.c0; c < band.c1; ++c) {
+                if (ll) {
+                    // The LL band still looks like the image: code its MED residuals.
+                    int A = (c > 0) ? coeff(r, c - 1) : 0;
+                    int B = (r > 0) ? coeff(r - 1, c) : 0;
+                    int C = (r > 0 && c > 0) ? coeff(r - 1, c - 1) : 0;
+                    values.push_back(coeff(r, c) - predict(A, B, C));
+                } else {
+                    values.push_back(coeff(r, c));
+                }
+            }
+        }
 
-            if (X < 0) X = 0;
-            if (X > 255) X = 255;
-            img.at<uint8_t>(r, c) = static_cast<uint8_t>(X);
+        if (m_adaptive) {
+            int m = subband_m(values);
+            bs.write_n_bits(static_cast<uint64_t>(m), 16);
+            golomb.set_m(m);
+        }
+        for (int v : values) {
+            golomb.encode(v, bs);
         }
     }
+}
 
-    bs.close();
-    in_fs.close();
+template <typename T>
+void ImageCodec::decode_wavelet(Image& img, const CodecHeader& header, BitStream& bs) {
+    int levels = static_cast<int>(bs.read_n_bits(4));
+
+    // A 1/2^t thumbnail is the LL band of level t: the finer subbands are
+    // never read and only the coarser levels are inverted.
+    int first_level = 0;
+    while (first_level < levels && (2 << first_level) <= m_thumbnail_scale) first_level++;
+
+    std::vector<int32_t> plane(static_cast<size_t>(img.rows) * img.cols, 0);
+    auto coeff = [&](int r, int c) -> int32_t& { return plane[static_cast<size_t>(r) * img.cols + c]; };
+    Golomb golomb(header.adaptive ? 1 : header.fixed_m, NegativeHandling::INTERLEAVING);
+
+    for (const Subband& band : wavelet_subbands(img.rows, img.cols, levels)) {
+        bool ll = (band.r0 == 0 && band.c0 == 0);
+        if (!ll && band.level <= first_level) break;
+
+        if (header.adaptive) {
+            int m = static_cast<int>(bs.read_n_bits(16));
+            if (m <= 0) m = 1;
+            golomb.set_m(m);
+        }
+
+        for (int r = band.r0; r < band.r1; ++r) {
+            for (int c = band.c0; c < band.c1; ++c) {
+                int v = golomb.decode(bs);
+                if (ll) {
+                    int A = (c > 0) ? coeff(r, c - 1) : 0;
+                    int B = (r > 0) ? coeff(r - 1, c) : 0;
+                    int C = (r > 0 && c > 0) ? coeff(r - 1, c - 1) : 0;
+                    v += predict(A, B, C);
+                }
+                coeff(r, c) = v;
+            }
+        }
+    }
+
+    dwt53_inverse(plane.data(), img.rows, img.cols, levels, first_level);
+
+    // The LL band of level t is stored on the 2^t grid, where the thumbnail
+    // sampling in decode() picks it up.
+    const int h = wavelet_size(img.rows, first_level);
+    const int w = wavelet_size(img.cols, first_level);
+    for (int r = 0; r < h; ++r) {
+        for (int c = 0; c < w; ++c) {
+            img.at<T>(r << first_level, c << first_level) = static_cast<T>(std::clamp<int>(coeff(r, c), 0, m_maxval));
+        }
+    }
+    m_decoded_scale = 1 << first_level;
+}
+
+// Rough cost of an image under MED: the bit length of every residual.
+template <typename T>
+static long med_cost(const Image& img) {
+    long bits = 0;
+    for (int r = 0; r < img.rows; ++r) {
+        const T* row = img.ptr<T>(r);
+        const T* up = (r > 0) ? img.ptr<T>(r - 1) : nullptr;
+        for (int c = 0; c < img.cols; ++c) {
+            int A = (c > 0) ? row[c - 1] : 0;
+            int B = up ? up[c] : 0;
+            int C = (up && c > 0) ? up[c - 1] : 0;
+            int P;
+            if (C >= std::max(A, B)) P = std::min(A, B);
+            else if (C <= std::min(A, B)) P = std::max(A, B);
+            else P = A + B - C;
+            bits += std::bit_width(static_cast<unsigned>(std::abs(row[c] - P)));
+        }
+    }
+    return bits;
+}
+
+template <typename T>
+std::vector<int> ImageCodec::build_palette(const Image& img) {
+    std::vector<uint32_t> histogram(static_cast<size_t>(m_maxval) + 1, 0);
+    for (int r = 0; r < img.rows; ++r) {
+        const T* row = img.ptr<T>(r);
+        for (int c = 0; c < img.cols; ++c) histogram[row[c]]++;
+    }
 
-    cv::Mat img_to_save;
+    // Indices follow the grey levels in ascending order, so neighbouring
+    // indices stay neighbouring intensities and prediction still works.
+    std::vector<int> palette;
+    for (int v = 0; v <= m_maxval; ++v) {
+        if (histogram[v] == 0) continue;
+        if (palette.size() == 256) return {};
+        palette.push_back(v);
+    }
+
+    // Keep the palette only when the index plane predicts better than the
+    // samples themselves, palette included.
+    Image indices = apply_palette<T>(img, palette);
+    long palette_bits = 8 + static_cast<long>(palette.size()) * (img.maxval > 255 ? 16 : 8);
+    if (med_cost<uint8_t>(indices) + palette_bits >= med_cost<T>(img)) return {};
+    return palette;
+}
+
+template <typename T>
+Image ImageCodec::apply_palette(const Image& img, const std::vector<int>& palette) {
+    std::vector<uint8_t> index_of(static_cast<size_t>(palette.back()) + 1, 0);
+    for (size_t i = 0; i < palette.size(); ++i) index_of[palette[i]] = static_cast<uint8_t>(i);
+
+    Image indices(img.rows, img.cols, 1, 1, img.maxval);
+    for (int r = 0; r < img.rows; ++r) {
+        const T* src = img.ptr<T>(r);
+        uint8_t* dst = indices.ptr<uint8_t>(r);
+        for (int c = 0; c < img.cols; ++c) dst[c] = index_of[src[c]];
+    }
+    return indices;
+}
 
-    std::string ext = m_out_file.substr(m_out_file.find_last_of("."));
-    std::cout << "Converting to BGR for .ppm output...\n";
-    cv::cvtColor(img, img_to_save, cv::COLOR_GRAY2BGR);
+Image ImageCodec::expand_palette(const Image& indices, const std::vector<int>& palette, int maxval) {
+    bool wide = maxval > 255;
+    Image img(indices.rows, indices.cols, wide ? 2 : 1, 1, maxval);
+    for (int r = 0; r < img.rows; ++r) {
+        const uint8_t* src = indices.ptr<uint8_t>(r);
+        for (int c = 0; c < img.cols; ++c) {
+            // Indices past the palette can only come from a corrupt file.
+            int level = palette[std::min<size_t>(src[c], palette.size() - 1)];
+            if (wide) img.at<uint16_t>(r, c) = static_cast<uint16_t>(level);
+            else img.at<uint8_t>(r, c) = static_cast<uint8_t>(level);
+        }
+    }
+    return img;
+}
 
+// Raster scan for the weighted predictor mode: the first and last columns
+// and the first row take the general path, the rest of every row the
+// branch-free one. 'code(r, c, P)' returns the sample the decoder sees.
+template <typename T, typename Code>
+static void weighted_scan(Image& img, WeightedPredictor& wp, Code&& code) {
+    const int cols = img.cols;
+    for (int r = 0; r < img.rows; ++r) {
+        T* row = img.ptr<T>(r);
+        const T* up = (r > 0) ? img.ptr<T>(r - 1) : nullptr;
+        wp.start_row(r);
 
-    if (!cv::imwrite(m_out_file, img_to_save)) {
-        throw std::runtime_error("Failed to save decoded image to: " + m_out_file);
+        int c = 0;
+        if (r > 0 && cols >= 3) {
+            wp.update(0, code(r, 0, wp.predict_at(row, up, 0)));
+            for (c = 1; c < cols - 1; ++c) {
+                wp.update(c, code(r, c, wp.predict(c, row[c - 1], up[c], up[c - 1], up[c + 1])));
+            }
+        }
+        for (; c < cols; ++c) {
+            wp.update(c, code(r, c, wp.predict_at(row, up, c)));
+        }
     }
+}
+
+template <typename T>
+void ImageCodec::encode_weighted(Image& img, BitStream& bs) {
+    WeightedPredictor wp(img.cols, m_maxval);
+    OnlineRice online(std::bit_width(static_cast<unsigned>(m_maxval)));
+    std::vector<int> prev_mag(img.cols + 2, 0), cur_mag(img.cols + 2, 0);
+
+    T* row = nullptr;
+    weighted_scan<T>(img, wp, [&](int r, int c, int P) {
+        if (c == 0) {
+            row = img.ptr<T>(r);
+            if (r > 0) std::swap(prev_mag, cur_mag);
+        }
+        int residual = static_cast<int>(row[c]) - P;
+        if (m_near > 0) {
+            residual = quantize_residual(residual);
+            row[c] = static_cast<T>(reconstruct_sample(P, residual));
+        }
+        online.encode(residual, prev_mag.data(), cur_mag.data(), c, bs);
+        return static_cast<int>(row[c]);
+    });
+}
+
+template <typename T>
+void ImageCodec::decode_weighted(Image& img, const CodecHeader& header, BitStream& bs) {
+    WeightedPredictor wp(img.cols, m_maxval);
+    OnlineRice online(header.bit_depth);
+    std::vector<int> prev_mag(img.cols + 2, 0), cur_mag(img.cols + 2, 0);
+
+    T* row = nullptr;
+    weighted_scan<T>(img, wp, [&](int r, int c, int P) {
+        if (c == 0) {
+            row = img.ptr<T>(r);
+            if (r > 0) std::swap(prev_mag, cur_mag);
+        }
+        int x = reconstruct_sample(P, online.decode(prev_mag.data(), cur_mag.data(), c, bs));
+        row[c] = static_cast<T>(x);
+        return x;
+    });
+}
+
+// Quadtree mode. The image is split into QT_ROOT x QT_ROOT tiles, each
+// recursively divided down to QT_CELL x QT_CELL cells. Every leaf carries a
+// predictor and a Rice parameter k (Golomb m = 2^k). The whole tree, with
+// the leaf parameters, is coded first; the pixels then follow in raster
+// order, each looking up its leaf through a per-cell parameter map.
+static const int QT_CELL = 8;
+static const int QT_ROOT = 64;
+static const int QT_MAX_K = 15;
+static const int QT_LEAF_BITS = PREDICTOR_BITS + 4;
+
+// Summed-area tables over the cell grid of |residual| for every predictor,
+// with the predictor index innermost so a block's sums for all predictors
+// are four contiguous loads.
+struct ResidualSums {
+    int cells_y, cells_x;
+    std::vector<int64_t> sat;  // (cells_y + 1) x (cells_x + 1) x NUM_PREDICTORS
+
+    const int64_t* at(int cy, int cx) const {
+        return &sat[(static_cast<size_t>(cy) * (cells_x + 1) + cx) * NUM_PREDICTORS];
+    }
+
+    void block(int cy0, int cx0, int cy1, int cx1, int64_t sums[NUM_PREDICTORS]) const {
+        const int64_t* a = at(cy1, cx1);
+        const int64_t* b = at(cy0, cx1);
+        const int64_t* c = at(cy1, cx0);
+        const int64_t* d = at(cy0, cx0);
+        for (int p = 0; p < NUM_PREDICTORS; ++p) sums[p] = a[p] - b[p] - c[p] + d[p];
+    }
+};
+
+template <typename T>
+static ResidualSums residual_sums(const Image& img, int maxval) {
+    ResidualSums rs;
+    rs.cells_y = (img.rows + QT_CELL - 1) / QT_CELL;
+    rs.cells_x = (img.cols + QT_CELL - 1) / QT_CELL;
+    rs.sat.assign(static_cast<size_t>(rs.cells_y + 1) * (rs.cells_x + 1) * NUM_PREDICTORS, 0);
+
+    // Zero-padded int copy of the image, as in choose_predictor.
+    const int pad = 2;
+    const int width = img.cols + 2 * pad;
+    std::vector<int> plane(static_cast<size_t>(img.rows + 2) * width, 0);
+    for (int r = 0; r < img.rows; ++r) {
+        const T* src = img.ptr<T>(r);
+        std::copy(src, src + img.cols, &plane[static_cast<size_t>(r + 2) * width + pad]);
+    }
+
+    std::vector<int64_t> cell_row(static_cast<size_t>(rs.cells_x) * NUM_PREDICTORS);
+    for (int cy = 0; cy < rs.cells_y; ++cy) {
+        std::fill(cell_row.begin(), cell_row.end(), 0);
+        for (int r = cy * QT_CELL; r < std::min((cy + 1) * QT_CELL, img.rows); ++r) {
+            const int* cur = &plane[static_cast<size_t>(r + 2) * width + pad];
+            for (int cx = 0; cx < rs.cells_x; ++cx) {
+                int c0 = cx * QT_CELL;
+                int n = std::min(QT_CELL, img.cols - c0);
+                long costs[NUM_PREDICTORS] = {};
+                row_costs(cur + c0, cur + c0 - width, cur + c0 - 2 * width, n, maxval, costs);
+                for (int p = 0; p < NUM_PREDICTORS; ++p) {
+                    cell_row[static_cast<size_t>(cx) * NUM_PREDICTORS + p] += costs[p];
+                }
+            }
+        }
+
+        // Running sums along the row, then add the table row above.
+        std::vector<int64_t> run(NUM_PREDICTORS, 0);
+        for (int cx = 0; cx < rs.cells_x; ++cx) {
+            int64_t* dst = &rs.sat[(static_cast<size_t>(cy + 1) * (rs.cells_x + 1) + cx + 1) * NUM_PREDICTORS];
+            const int64_t* above = rs.at(cy, cx + 1);
+            for (int p = 0; p < NUM_PREDICTORS; ++p) {
+                run[p] += cell_row[static_cast<size_t>(cx) * NUM_PREDICTORS + p];
+                dst[p] = above[p] + run[p];
+            }
+        }
+    }
+    return rs;
+}
+
+// Cheapest (predictor, k) for a block of n pixels with the given residual
+// sums: a Rice code spends about k + 1 bits per value plus 2|e| >> k in
+// unary (the values are interleaved). With NEAR > 0 the coded residuals are
+// quantized by 2 * NEAR + 1, which on average divides their magnitudes by
+// the same step. Returns the estimated bits.
+static long best_leaf(const int64_t sums[NUM_PREDICTORS], long n, int near, int& predictor, int& k) {
+    int64_t coded[NUM_PREDICTORS];
+    for (int p = 0; p < NUM_PREDICTORS; ++p) coded[p] = sums[p] / (2 * near + 1);
+    long best = std::numeric_limits<long>::max();
+    for (int kk = 0; kk <= QT_MAX_K; ++kk) {
+        long cost[NUM_PREDICTORS];
+        for (int p = 0; p < NUM_PREDICTORS; ++p) cost[p] = n * (kk + 1) + ((2 * coded[p]) >> kk);
+        for (int p = 0; p < NUM_PREDICTORS; ++p) {
+            if (cost[p] < best) {
+                best = cost[p];
+                predictor = p;
+                k = kk;
+            }
+        }
+    }
+    return best;
+}
+
+struct QuadNode {
+    int cy, cx, size;  // in cells
+    bool split;
+    int predictor, k;
+};
+
+// Chooses the tree below a node (bottom-up) and appends it to 'nodes' in
+// the order it is coded. Returns the estimated cost in bits.
+static long plan_quadtree(const ResidualSums& rs, int cy, int cx, int size, int rows, int cols, int near,
+                          std::vector<QuadNode>& nodes) {
+    int cy1 = std::min(cy + size, rs.cells_y);
+    int cx1 = std::min(cx + size, rs.cells_x);
+    long n = static_cast<long>(std::min(cy1 * QT_CELL, rows) - cy * QT_CELL) *
+             (std::min(cx1 * QT_CELL, cols) - cx * QT_CELL);
+
+    int64_t sums[NUM_PREDICTORS];
+    rs.block(cy, cx, cy1, cx1, sums);
+    QuadNode leaf { cy, cx, size, false, PRED_MED, 0 };
+    long leaf_cost = best_leaf(sums, n, near, leaf.predictor, leaf.k) + QT_LEAF_BITS + (size > 1 ? 1 : 0);
+    if (size == 1) {
+        nodes.push_back(leaf);
+        return leaf_cost;
+    }
+
+    size_t mark = nodes.size();
+    nodes.push_back({ cy, cx, size, true, 0, 0 });
+    long split_cost = 1;
+    int half = size / 2;
+    for (int q = 0; q < 4; ++q) {
+        int qy = cy + (q / 2) * half;
+        int qx = cx + (q % 2) * half;
+        if (qy < rs.cells_y && qx < rs.cells_x) {
+            split_cost += plan_quadtree(rs, qy, qx, half, rows, cols, near, nodes);
+        }
+    }
+    if (split_cost < leaf_cost) return split_cost;
+
+    nodes.resize(mark);
+    nodes.push_back(leaf);
+    return leaf_cost;
+}
+
+// Reads one node (and its subtree) and fills the cell parameter map.
+static void read_quadtree(BitStream& bs, int cy, int cx, int size, int cells_y, int cells_x,
+                          std::vector<uint8_t>& cell_pred, std::vector<uint8_t>& cell_k) {
+    if (size > 1 && bs.read_bit() == 1) {
+        int half = size / 2;
+        for (int q = 0; q < 4; ++q) {
+            int qy = cy + (q / 2) * half;
+            int qx = cx + (q % 2) * half;
+            if (qy < cells_y && qx < cells_x) {
+                read_quadtree(bs, qy, qx, half, cells_y, cells_x, cell_pred, cell_k);
+            }
+        }
+        return;
+    }
+
+    int predictor = static_cast<int>(bs.read_n_bits(PREDICTOR_BITS));
+    int k = static_cast<int>(bs.read_n_bits(4));
+    if (predictor >= NUM_PREDICTORS) {
+        throw std::runtime_error("Invalid predictor selector.");
+    }
+    for (int y = cy; y < std::min(cy + size, cells_y); ++y) {
+        for (int x = cx; x < std::min(cx + size, cells_x); ++x) {
+            cell_pred[static_cast<size_t>(y) * cells_x + x] = static_cast<uint8_t>(predictor);
+            cell_k[static_cast<size_t>(y) * cells_x + x] = static_cast<uint8_t>(k);
+        }
+    }
+}
+
+template <typename T>
+void ImageCodec::encode_quadtree(Image& img, BitStream& bs) {
+    ResidualSums rs = residual_sums<T>(img, m_maxval);
+    const int cells_y = rs.cells_y, cells_x = rs.cells_x;
+    const int root = QT_ROOT / QT_CELL;
+
+    std::vector<QuadNode> nodes;
+    for (int cy = 0; cy < cells_y; cy += root) {
+        for (int cx = 0; cx < cells_x; cx += root) {
+            plan_quadtree(rs, cy, cx, root, img.rows, img.cols, m_near, nodes);
+        }
+    }
+
+    std::vector<uint8_t> cell_pred(static_cast<size_t>(cells_y) * cells_x);
+    std::vector<uint8_t> cell_k(cell_pred.size());
+    size_t leaves = 0;
+    for (const QuadNode& node : nodes) {
+        if (node.size > 1) bs.write_bit(node.split ? 1 : 0);
+        if (node.split) continue;
+        bs.write_n_bits(static_cast<uint64_t>(node.predictor), PREDICTOR_BITS);
+        bs.write_n_bits(static_cast<uint64_t>(node.k), 4);
+        for (int y = node.cy; y < std::min(node.cy + node.size, cells_y); ++y) {
+            for (int x = node.cx; x < std::min(node.cx + node.size, cells_x); ++x) {
+                cell_pred[static_cast<size_t>(y) * cells_x + x] = static_cast<uint8_t>(node.predictor);
+                cell_k[static_cast<size_t>(y) * cells_x + x] = static_cast<uint8_t>(node.k);
+            }
+        }
+        leaves++;
+    }
+    std::cout << "Quadtree: " << leaves << " leaves\n";
+
+    const int qbpp = std::bit_width(static_cast<unsigned>(m_maxval)) + 1;
+    const int limit = 2 * (qbpp + std::max(8, qbpp));
+    for (int r = 0; r < img.rows; ++r) {
+        const size_t cell_row = static_cast<size_t>(r / QT_CELL) * cells_x;
+        for (int c = 0; c < img.cols; ++c) {
+            size_t cell = cell_row + c / QT_CELL;
+            int P = predict_with(cell_pred[cell], neighbourhood<T>(img, r, c), m_maxval);
+            int residual = static_cast<int>(img.at<T>(r, c)) - P;
+            if (m_near > 0) {
+                residual = quantize_residual(residual);
+                img.at<T>(r, c) = static_cast<T>(reconstruct_sample(P, residual));
+            }
+            unsigned mapped = (residual >= 0) ? 2u * residual : -2u * residual - 1u;
+            Golomb::encode_rice(mapped, cell_k[cell], limit, qbpp, bs);
+        }
+    }
+}
+
+template <typename T>
+void ImageCodec::decode_quadtree(Image& img, const CodecHeader& header, BitStream& bs) {
+    const int cells_y = (img.rows + QT_CELL - 1) / QT_CELL;
+    const int cells_x = (img.cols + QT_CELL - 1) / QT_CELL;
+    const int root = QT_ROOT / QT_CELL;
+
+    std::vector<uint8_t> cell_pred(static_cast<size_t>(cells_y) * cells_x);
+    std::vector<uint8_t> cell_k(cell_pred.size());
+    for (int cy = 0; cy < cells_y; cy += root) {
+        for (int cx = 0; cx < cells_x; cx += root) {
+            read_quadtree(bs, cy, cx, root, cells_y, cells_x, cell_pred, cell_k);
+        }
+    }
+
+    const int qbpp = header.bit_depth + 1;
+    const int limit = 2 * (qbpp + std::max(8, qbpp));
+    for (int r = 0; r < img.rows; ++r) {
+        const size_t cell_row = static_cast<size_t>(r / QT_CELL) * cells_x;
+        for (int c = 0; c < img.cols; ++c) {
+            size_t cell = cell_row + c / QT_CELL;
+            int P = predict_with(cell_pred[cell], neighbourhood<T>(img, r, c), m_maxval);
+            unsigned mapped = Golomb::decode_rice(cell_k[cell], limit, qbpp, bs);
+            int residual = (mapped & 1) ? -static_cast<int>((mapped + 1) / 2) : static_cast<int>(mapped / 2);
+            img.at<T>(r, c) = static_cast<T>(reconstruct_sample(P, residual));
+        }
+    }
+}
+
+// Per-band predictors of the sequence mode. The temporal ones read the
+// previous decoded frame at the same position (P' below):
+//   TEMPORAL_DIFF  P' + MED of the frame difference at W, N and NW
+//   TEMPORAL_BLEND rounded mean of spatial MED and P'
+enum TemporalPredictor {
+    TEMPORAL_SPATIAL = 0,
+    TEMPORAL_PREV = 1,
+    TEMPORAL_DIFF = 2,
+    TEMPORAL_BLEND = 3,
+    NUM_TEMPORAL_PREDICTORS = 4
+};
+static const int TEMPORAL_BITS = 2;
+
+template <typename T>
+static void temporal_candidates(const Image& cur, const Image& prev, int r, int c, int maxval,
+                                int P[NUM_TEMPORAL_PREDICTORS]) {
+    auto px = [](const Image& img, int r, int c) { return (r < 0 || c < 0) ? 0 : static_cast<int>(img.at<T>(r, c)); };
+    auto med = [](int A, int B, int C) {
+        if (C >= std::max(A, B)) return std::min(A, B);
+        if (C <= std::min(A, B)) return std::max(A, B);
+        return A + B - C;
+    };
+
+    int A = px(cur, r, c - 1), B = px(cur, r - 1, c), C = px(cur, r - 1, c - 1);
+    int spatial = med(A, B, C);
+    int here = static_cast<int>(prev.at<T>(r, c));
+    int diff = med(A - px(prev, r, c - 1), B - px(prev, r - 1, c), C - px(prev, r - 1, c - 1));
+
+    P[TEMPORAL_SPATIAL] = spatial;
+    P[TEMPORAL_PREV] = here;
+    P[TEMPORAL_DIFF] = std::clamp(here + diff, 0, maxval);
+    P[TEMPORAL_BLEND] = (spatial + here + 1) >> 1;
+}
+
+template <typename T>
+void ImageCodec::encode_frame(Image& img, const Image* prev, BitStream& bs) {
+    Golomb golomb(m_adaptive ? 1 : m_fixed_m, NegativeHandling::INTERLEAVING);
+    std::vector<int> block;
+    int P[NUM_TEMPORAL_PREDICTORS];
+
+    for (int r0 = 0; r0 < img.rows; r0 += BLOCK_SIZE_Y) {
+        int r1 = std::min(r0 + BLOCK_SIZE_Y, img.rows);
+
+        // The first frame has nothing to look back at and stays spatial.
+        int predictor = TEMPORAL_SPATIAL;
+        if (prev) {
+            long costs[NUM_TEMPORAL_PREDICTORS] = {};
+            for (int r = r0; r < r1; ++r) {
+                for (int c = 0; c < img.cols; ++c) {
+                    temporal_candidates<T>(img, *prev, r, c, m_maxval, P);
+                    int X = static_cast<int>(img.at<T>(r, c));
+                    for (int p = 0; p < NUM_TEMPORAL_PREDICTORS; ++p) costs[p] += std::abs(X - P[p]);
+                }
+            }
+            predictor = static_cast<int>(std::min_element(costs, costs + NUM_TEMPORAL_PREDICTORS) - costs);
+            bs.write_n_bits(static_cast<uint64_t>(predictor), TEMPORAL_BITS);
+        }
+
+        block.clear();
+        for (int r = r0; r < r1; ++r) {
+            for (int c = 0; c < img.cols; ++c) {
+                int pred;
+                if (prev) {
+                    temporal_candidates<T>(img, *prev, r, c, m_maxval, P);
+                    pred = P[predictor];
+                } else {
+                    pred = predict(get_pixel<T>(img, r, c - 1), get_pixel<T>(img, r - 1, c), get_pixel<T>(img, r - 1, c - 1));
+                }
+
+                int residual = static_cast<int>(img.at<T>(r, c)) - pred;
+                if (m_near > 0) {
+                    residual = quantize_residual(residual);
+                    img.at<T>(r, c) = static_cast<T>(reconstruct_sample(pred, residual));
+                }
+                block.push_back(residual);
+            }
+        }
+
+        if (m_adaptive) {
+            int m = calculate_m(block);
+            bs.write_n_bits(static_cast<uint64_t>(m), 16);
+            golomb.set_m(m);
+        }
+        for (int residual : block) {
+            golomb.encode(residual, bs);
+        }
+    }
+}
+
+template <typename T>
+void ImageCodec::decode_frame(Image& img, const Image* prev, const CodecHeader& header, BitStream& bs) {
+    Golomb golomb(header.adaptive ? 1 : header.fixed_m, NegativeHandling::INTERLEAVING);
+    int predictor = TEMPORAL_SPATIAL;
+    int P[NUM_TEMPORAL_PREDICTORS];
+
+    for (int r = 0; r < img.rows; ++r) {
+        if (r % BLOCK_SIZE_Y == 0) {
+            if (prev) {
+                predictor = static_cast<int>(bs.read_n_bits(TEMPORAL_BITS));
+            }
+            if (header.adaptive) {
+                int m = static_cast<int>(bs.read_n_bits(16));
+                if (m <= 0) m = 1;
+                golomb.set_m(m);
+            }
+        }
+
+        for (int c = 0; c < img.cols; ++c) {
+            int pred;
+            if (prev) {
+                temporal_candidates<T>(img, *prev, r, c, m_maxval, P);
+                pred = P[predictor];
+            } else {
+                pred = predict(get_pixel<T>(img, r, c - 1), get_pixel<T>(img, r - 1, c), get_pixel<T>(img, r - 1, c - 1));
+            }
+            img.at<T>(r, c) = static_cast<T>(reconstruct_sample(pred, golomb.decode(bs)));
+        }
+    }
+}
+
+// Expands a printf-style frame pattern such as "frame_%04d.pgm". Only a
+// single integer conversion is accepted, since the pattern comes from the
+// command line.
+static std::string frame_path(const std::string& pattern, int index) {
+    size_t pos = pattern.find('%');
+    size_t end = pos;
+    if (pos != std::string::npos) {
+        end = pos + 1;
+        while (end < pattern.size() && std::isdigit(static_cast<unsigned char>(pattern[end]))) end++;
+    }
+    if (pos == std::string::npos || end >= pattern.size() || pattern[end] != 'd' ||
+        pattern.find('%', end) != std::string::npos) {
+        throw std::invalid_argument("Sequence file names need one %d conversion (e.g. frame_%03d.pgm).");
+    }
+
+    char number[64];
+    std::snprintf(number, sizeof(number), pattern.substr(pos, end - pos + 1).c_str(), index);
+    return pattern.substr(0, pos) + number + pattern.substr(end + 1);
+}
+
+static Image read_frame(const std::string& path) {
+    if (is_gzip_path(path)) {
+        GzPnmReader reader(path, true);
+        reader.wait_rows(reader.image().rows);
+        return reader.image();
+    }
+    return read_pnm(path, true);
+}
+
+void ImageCodec::encode_sequence() {
+    // Numbering starts at 0 or 1, whichever exists, and stops at the first gap.
+    int first = std::filesystem::exists(frame_path(m_in_file, 0)) ? 0 : 1;
+    if (!std::filesystem::exists(frame_path(m_in_file, first))) {
+        throw std::runtime_error("No frame found for " + m_in_file);
+    }
+
+    // Only the frame being coded and the previous one are kept.
+    Image prev;
+    Image cur = read_frame(frame_path(m_in_file, first));
+    bool wide = cur.wide();
+    // Later frames may use more bits than the first one.
+    m_maxval = wide ? 65535 : 255;
+    std::cout << "Input: " << cur.cols << "x" << cur.rows << ", " << (wide ? 16 : 8) << "-bit grayscale frames\n";
+    print_mode(CodingMode::SEQUENCE, m_adaptive, m_fixed_m);
+
+    std::fstream out_fs(m_out_file, std::ios::out | std::ios::binary);
+    if (!out_fs) {
+        throw std::runtime_error("Failed to create output file.");
+    }
+
+    CodecHeader codec_h;
+    codec_h.width = cur.cols;
+    codec_h.height = cur.rows;
+    codec_h.adaptive = m_adaptive;
+    codec_h.fixed_m = static_cast<uint16_t>(m_fixed_m);
+    codec_h.mode = static_cast<uint8_t>(CodingMode::SEQUENCE);
+    codec_h.bit_depth = wide ? 16 : 8;
+    codec_h.maxval = static_cast<uint16_t>(cur.maxval);
+    codec_h.near = static_cast<uint8_t>(m_near);
+    write_codec_header(codec_h, out_fs);
+
+    BitStream bs(out_fs, STREAM_WRITE);
+    bs.write_n_bits(static_cast<uint64_t>(first), 16);
+
+    int frames = 0;
+    uintmax_t in_size = 0;
+    for (int index = first;; ++index) {
+        std::string path = frame_path(m_in_file, index);
+        if (index != first) {
+            if (!std::filesystem::exists(path)) break;
+            cur = read_frame(path);
+        }
+        if (cur.rows != static_cast<int>(codec_h.height) || cur.cols != static_cast<int>(codec_h.width) || cur.wide() != wide) {
+            throw std::runtime_error("Frame " + path + " does not match the size or depth of the first frame.");
+        }
+
+        bs.write_bit(1);
+        if (wide) {
+            encode_frame<uint16_t>(cur, prev.empty() ? nullptr : &prev, bs);
+        } else {
+            encode_frame<uint8_t>(cur, prev.empty() ? nullptr : &prev, bs);
+        }
+        prev = cur;
+        frames++;
+        in_size += std::filesystem::file_size(path);
+    }
+    bs.write_bit(0);
+
+    bs.close();
+    out_fs.close();
+    std::cout << "Encoding complete: " << frames << " frames.\n";
+
+    uintmax_t out_size = std::filesystem::file_size(m_out_file);
+    std::cout << "\n--- Compression Stats ---\n";
+    std::cout << "Original Size:   " << in_size << " bytes\n";
+    std::cout << "Compressed Size: " << out_size << " bytes\n";
+    if (out_size > 0) {
+        std::cout << "Compression Rate: " << std::fixed << std::setprecision(2)
+                  << static_cast<double>(in_size) / out_size << ":1\n";
+    }
+}
+
+void ImageCodec::decode_sequence(const CodecHeader& header, BitStream& bs) {
+    bool wide = header.bit_depth > 8;
+    int index = static_cast<int>(bs.read_n_bits(16));
+    frame_path(m_out_file, index);  // reject a bad pattern before decoding
+
+    Image prev;
+    int frames = 0;
+    while (bs.read_bit() == 1) {
+        Image cur(header.height, header.width, wide ? 2 : 1, 1, header.maxval);
+        if (wide) {
+            decode_frame<uint16_t>(cur, prev.empty() ? nullptr : &prev, header, bs);
+        } else {
+            decode_frame<uint8_t>(cur, prev.empty() ? nullptr : &prev, header, bs);
+        }
+        write_pnm(frame_path(m_out_file, index++), cur);
+        prev = cur;
+        frames++;
+    }
+    std::cout << "Decoding complete: " << frames << " frames saved to " << m_out_file << "\n";
+}
+
+void ImageCodec::wait_rows(int n) {
+    if (m_stream) m_stream->wait_rows(n);
+}
+
+int ImageCodec::sample_bit_depth(const Image& img) {
+    // 16-bit containers often hold 10/12/14-bit data; code only the bits in
+    // use, but never fewer than 9 so the decoder keeps a 16-bit container.
+    int max_sample = 0;
+    for (int r = 0; r < img.rows; ++r) {
+        const uint16_t* row = img.ptr<uint16_t>(r);
+        for (int c = 0; c < img.cols; ++c) {
+            max_sample = std::max(max_sample, static_cast<int>(row[c]));
+        }
+    }
+    int bits = 9;
+    while (bits < 16 && (max_sample >> bits) != 0) bits++;
+    return bits;
+}
+
+template <typename T>
+void ImageCodec::encode_samples(Image& img, CodingMode mode, const int levels[2], BitStream& bs) {
+    if (mode == CodingMode::BILEVEL) {
+        encode_bilevel<T>(img, levels, bs);
+    } else if (mode == CodingMode::CONTEXT) {
+        encode_context<T>(img, bs);
+    } else if (mode == CodingMode::PROGRESSIVE) {
+        encode_progressive<T>(img, bs);
+    } else if (mode == CodingMode::WAVELET) {
+        encode_wavelet<T>(img, bs);
+    } else if (mode == CodingMode::WEIGHTED) {
+        encode_weighted<T>(img, bs);
+    } else if (mode == CodingMode::QUADTREE) {
+        encode_quadtree<T>(img, bs);
+    } else {
+        encode_blocks<T>(img, bs, mode == CodingMode::BLOCK_SELECT);
+    }
+}
+
+void ImageCodec::encode() {
+    std::cout << "Encoding " << m_in_file << " to " << m_out_file << "...\n";
+    if (m_mode == CodingMode::SEQUENCE) {
+        encode_sequence();
+        return;
+    }
+
+    // Gzip-compressed inputs are inflated on a worker thread while the
+    // band-based modes already code the rows that are ready.
+    std::unique_ptr<GzPnmReader> stream;
+    Image img;
+    if (is_gzip_path(m_in_file)) {
+        stream = std::make_unique<GzPnmReader>(m_in_file, true);
+        img = stream->image();
+        m_stream = stream.get();
+    } else {
+        img = read_pnm(m_in_file, true);
+    }
+    bool wide = img.wide();
+    // Lossless 8-bit block coding of a gzip input can overlap with the
+    // inflation; everything else (including the near-lossless copy below
+    // and the row substreams, which need every row up front) waits.
+    bool streamed_mode = (m_mode == CodingMode::BLOCK_MED || m_mode == CodingMode::BLOCK_SELECT) && !m_row_streams;
+    bool whole_image = !m_stream || wide || !streamed_mode || m_near > 0;
+    if (whole_image) {
+        wait_rows(img.rows);
+    } else {
+        // The palette decision needs the whole histogram, unless the rows
+        // seen so far already use all 256 levels: that palette would be
+        // the identity, which build_palette never keeps. Until then keep
+        // waiting, so a gzip input is coded exactly like the raw file.
+        std::array<bool, 256> seen {};
+        int levels = 0;
+        for (int r = 0; r < img.rows && levels < 256; ++r) {
+            wait_rows(r + 1);
+            const uint8_t* row = img.ptr<uint8_t>(r);
+            for (int c = 0; c < img.cols; ++c) {
+                if (!seen[row[c]]) {
+                    seen[row[c]] = true;
+                    levels++;
+                }
+            }
+        }
+        whole_image = (levels < 256);
+    }
+    int bit_depth = wide ? sample_bit_depth(img) : 8;
+    m_maxval = (1 << bit_depth) - 1;
+    std::cout << "Input: " << img.cols << "x" << img.rows << ", " << bit_depth << "-bit grayscale\n";
+
+    // Images with few grey levels are coded as a plane of palette indices.
+    const int source_maxval = img.maxval;
+    std::vector<int> palette;
+    if (m_near == 0 && whole_image) {
+        palette = wide ? build_palette<uint16_t>(img) : build_palette<uint8_t>(img);
+    }
+    if (!palette.empty()) {
+        img = wide ? apply_palette<uint16_t>(img, palette) : apply_palette<uint8_t>(img, palette);
+        wide = false;
+        bit_depth = 1;
+        while ((1 << bit_depth) < static_cast<int>(palette.size())) bit_depth++;
+        m_maxval = (1 << bit_depth) - 1;
+        std::cout << "Palette: " << palette.size() << " grey levels, " << bit_depth << "-bit indices\n";
+    }
+
+    // Two-level images in context mode go through the binary path instead.
+    CodingMode mode = m_mode;
+    int levels[2] = {0, 0};
+    if (mode == CodingMode::CONTEXT) {
+        int count = wide ? count_levels<uint16_t>(img, levels) : count_levels<uint8_t>(img, levels);
+        if (count <= 2) mode = CodingMode::BILEVEL;
+    }
+    print_mode(mode, m_adaptive, m_fixed_m, m_online_k);
+    if (m_near > 0) {
+        std::cout << "Near-lossless: NEAR = " << m_near
+                  << (mode == CodingMode::BILEVEL ? " (ignored, bilevel is lossless)" : "") << "\n";
+    }
+
+    // Near-lossless encoders overwrite each sample with its reconstruction,
+    // so they work on a private copy and keep the original for the PSNR.
+    Image work = (m_near > 0) ? img.clone() : img;
+
+    std::fstream out_fs(m_out_file, std::ios::out | std::ios::binary);
+    if (!out_fs) {
+        throw std::runtime_error("Failed to create output file.");
+    }
+
+    CodecHeader codec_h;
+    codec_h.width = img.cols;
+    codec_h.height = img.rows;
+    codec_h.adaptive = m_adaptive;
+    codec_h.fixed_m = static_cast<uint16_t>(m_fixed_m);
+    codec_h.mode = static_cast<uint8_t>(mode);
+    codec_h.bit_depth = static_cast<uint8_t>(bit_depth);
+    codec_h.maxval = static_cast<uint16_t>(source_maxval);
+    codec_h.near = static_cast<uint8_t>(m_near);
+    codec_h.palette = !palette.empty();
+    codec_h.online_k = m_online_k;
+    codec_h.row_streams = m_row_streams;
+    write_codec_header(codec_h, out_fs);
+
+    BitStream bs(out_fs, STREAM_WRITE);
+    if (codec_h.palette) {
+        bs.write_n_bits(static_cast<uint64_t>(palette.size() - 1), 8);
+        for (int level : palette) {
+            bs.write_n_bits(static_cast<uint64_t>(level), source_maxval > 255 ? 16 : 8);
+        }
+    }
+    if (wide) {
+        encode_samples<uint16_t>(work, mode, levels, bs);
+    } else {
+        encode_samples<uint8_t>(work, mode, levels, bs);
+    }
+
+    bs.close();
+    out_fs.close();
+    if (m_row_streams) {
+        patch_row_sizes();
+    }
+    std::cout << "Encoding complete.\n";
+
+    if (m_near > 0) {
+        if (wide) {
+            print_distortion<uint16_t>(img, work);
+        } else {
+            print_distortion<uint8_t>(img, work);
+        }
+    }
+
+    uintmax_t inflated_size = stream ? stream->inflated_size() : 0;
+    m_stream = nullptr;
+
+    try {
+        uintmax_t in_file_size = stream ? inflated_size : std::filesystem::file_size(m_in_file);
+        uintmax_t out_file_size = std::filesystem::file_size(m_out_file);
+
+        if (out_file_size > 0) {
+            double compression_rate = static_cast<double>(in_file_size) / out_file_size;
+            
+            std::cout << "\n--- Compression Stats ---\n";
+            std::cout << "Original Size:   " << in_file_size << " bytes\n";
+            std::cout << "Compressed Size: " << out_file_size << " bytes\n";
+            std::cout << "Compression Rate: " << std::fixed << std::setprecision(2) << compression_rate << ":1\n";
+        } else {
+            std::cout << "\n--- Compression Stats ---\n";
+            std::cout << "Original Size:   " << in_file_size << " bytes\n";
+            std::cout << "Compressed Size: 0 bytes (Error?)\n";
+        }
+    } catch (std::filesystem::filesystem_error& e) {
+        std::cerr << "Could not get file sizes for stats: " << e.what() << std::endl;
+    }
+}
+
+template <typename T>
+void ImageCodec::decode_blocks(Image& img, const CodecHeader& header, BitStream& bs) {
+    if (header.row_streams) {
+        decode_rows<T>(img, header, bs);
+        return;
+    }
+
+    bool select_predictor = (static_cast<CodingMode>(header.mode) == CodingMode::BLOCK_SELECT);
+    int predictor = PRED_MED;
+    int initial_m = header.adaptive ? 1 : header.fixed_m;
+    Golomb golomb(initial_m, NegativeHandling::INTERLEAVING);
+    OnlineRice online(header.bit_depth);
+    std::vector<int> prev_mag(img.cols + 2, 0), cur_mag(img.cols + 2, 0);
+
+    for (int r = 0; r < img.rows; ++r) {
+        if (r % BLOCK_SIZE_Y == 0) {
+            if (select_predictor) {
+                predictor = static_cast<int>(bs.read_n_bits(PREDICTOR_BITS));
+                if (predictor >= NUM_PREDICTORS) {
+                    throw std::runtime_error("Invalid predictor selector.");
+                }
+            }
+            if (header.adaptive && !header.online_k) {
+                int m = static_cast<int>(bs.read_n_bits(16));
+                if (m <= 0) m = 1;
+                golomb.set_m(m);
+            }
+        }
+
+        for (int c = 0; c < img.cols; ++c) {
+            int P;
+            if (select_predictor) {
+                P = predict_with(predictor, neighbourhood<T>(img, r, c), m_maxval);
+            } else {
+                int A = get_pixel<T>(img, r, c - 1);
+                int B = get_pixel<T>(img, r - 1, c);
+                int C = get_pixel<T>(img, r - 1, c - 1);
+
+                P = predict(A, B, C);
+            }
+
+            int residual = header.online_k ? online.decode(prev_mag.data(), cur_mag.data(), c, bs) : golomb.decode(bs);
+
+            img.at<T>(r, c) = static_cast<T>(reconstruct_sample(P, residual));
+        }
+        std::swap(prev_mag, cur_mag);
+    }
+}
+
+template <typename T>
+int ImageCodec::decode_run(Image& img, int r, int c, ContextModel& model, BitStream& bs) {
+    T* row = img.ptr<T>(r);
+    T run_val = (c > 0) ? row[c - 1] : ((r > 0) ? img.at<T>(r - 1, 0) : 0);
+
+    while (true) {
+        int bit = bs.read_bit();
+        if (bit == EOF) {
+            throw std::runtime_error("EOF reached while decoding a run.");
+        }
+
+        if (bit == 1) {
+            int length = 1 << model.run_k();
+            int count = std::min(length, img.cols - c);
+            std::fill(row + c, row + c + count, run_val);
+            c += count;
+            if (count == length) model.run_hit();
+            if (c == img.cols) return c;
+            continue;
+        }
+
+        int count = (model.run_k() > 0) ? static_cast<int>(bs.read_n_bits(model.run_k())) : 0;
+        std::fill(row + c, row + c + count, run_val);
+        c += count;
+        break;
+    }
+
+    // Run interruption sample
+    int a, b, c_, d;
+    context_neighbours<T>(img, r, c, a, b, c_, d);
+    int ritype = (std::abs(a - b) <= m_near) ? 1 : 0;
+    int px = ritype ? a : b;
+    int sign = (ritype == 0 && a > b) ? -1 : 1;
+
+    int k = model.ri_k(ritype);
+    int emerrval = static_cast<int>(Golomb::decode_rice(k, model.ri_limit(), model.qbpp(), bs));
+    int errval = model.ri_unmap_error(ritype, k, emerrval);
+    model.ri_update(ritype, errval, emerrval);
+    model.run_miss();
+
+    row[c] = static_cast<T>(model.reconstruct(px, sign * errval));
+
+    return c + 1;
+}
+
+template <typename T>
+void ImageCodec::decode_context(Image& img, BitStream& bs) {
+    ContextModel model(m_maxval, m_near);
+
+    for (int r = 0; r < img.rows; ++r) {
+        T* row = img.ptr<T>(r);
+        int c = 0;
+        while (c < img.cols) {
+            int a, b, c_, d;
+            context_neighbours<T>(img, r, c, a, b, c_, d);
+
+            int sign;
+            int q = model.context(a, b, c_, d, sign);
+            if (q == ContextModel::RUN_CONTEXT) {
+                c = decode_run<T>(img, r, c, model, bs);
+                continue;
+            }
+            int px = model.predict(q, sign, a, b, c_);
+
+            int k = model.k(q);
+            int merrval = static_cast<int>(Golomb::decode_rice(k, model.limit(), model.qbpp(), bs));
+            int errval = model.unmap_error(q, k, merrval);
+            model.update(q, errval);
+
+            row[c] = static_cast<T>(model.reconstruct(px, sign * errval));
+            c++;
+        }
+    }
+}
+
+template <typename T>
+void ImageCodec::decode_bilevel(Image& img, BitStream& bs) {
+    int levels[2];
+    levels[0] = static_cast<int>(bs.read_n_bits(16));
+    levels[1] = static_cast<int>(bs.read_n_bits(16));
+
+    BinaryDecoder coder(bs);
+    std::vector<uint16_t> probs(1 << BILEVEL_CONTEXT_BITS, BINARY_PROB_INIT);
+    uint16_t same_row_prob = BINARY_PROB_INIT;
+
+    const int pad = 2;
+    std::vector<uint8_t> lines[3];
+    for (auto& line : lines) line.assign(img.cols + 2 * pad, 0);
+
+    for (int r = 0; r < img.rows; ++r) {
+        std::vector<uint8_t>& cur = lines[r % 3];
+        const std::vector<uint8_t>& up1 = lines[(r + 2) % 3];
+        const std::vector<uint8_t>& up2 = lines[(r + 1) % 3];
+
+        if (coder.decode(same_row_prob)) {
+            cur = up1;
+        } else {
+            for (int c = 0; c < img.cols; ++c) {
+                int ctx = bilevel_context(up2.data() + pad, up1.data() + pad, cur.data() + pad, c);
+                cur[c + pad] = static_cast<uint8_t>(coder.decode(probs[ctx]));
+            }
+        }
+
+        T* row = img.ptr<T>(r);
+        for (int c = 0; c < img.cols; ++c) {
+            row[c] = static_cast<T>(levels[cur[c + pad]]);
+        }
+    }
+}
+
+template <typename T>
+void ImageCodec::decode_samples(Image& img, const CodecHeader& header, BitStream& bs) {
+    CodingMode mode = static_cast<CodingMode>(header.mode);
+    if (mode == CodingMode::BILEVEL) {
+        decode_bilevel<T>(img, bs);
+    } else if (mode == CodingMode::CONTEXT) {
+        decode_context<T>(img, bs);
+    } else if (mode == CodingMode::PROGRESSIVE) {
+        decode_progressive<T>(img, header, bs);
+    } else if (mode == CodingMode::WAVELET) {
+        decode_wavelet<T>(img, header, bs);
+    } else if (mode == CodingMode::WEIGHTED) {
+        decode_weighted<T>(img, header, bs);
+    } else if (mode == CodingMode::QUADTREE) {
+        decode_quadtree<T>(img, header, bs);
+    } else if (mode == CodingMode::BLOCK_MED || mode == CodingMode::BLOCK_SELECT) {
+        decode_blocks<T>(img, header, bs);
+    } else {
+        throw std::runtime_error("Unknown GICL coding mode.");
+    }
+}
+
+void ImageCodec::decode() {
+    std::cout << "Decoding " << m_in_file << " to " << m_out_file << "...\n";
+
+    std::fstream in_fs(m_in_file, std::ios::in | std::ios::binary);
+    if (!in_fs) {
+        throw std::runtime_error("Failed to open input file.");
+    }
+
+    CodecHeader codec_h = read_codec_header(in_fs);
+    CodingMode mode = static_cast<CodingMode>(codec_h.mode);
+    std::cout << "Input: " << codec_h.width << "x" << codec_h.height << ", "
+              << static_cast<int>(codec_h.bit_depth) << "-bit\n";
+    print_mode(mode, codec_h.adaptive, codec_h.fixed_m, codec_h.online_k);
+
+    if (codec_h.bit_depth < 1 || codec_h.bit_depth > 16) {
+        throw std::runtime_error("Unsupported bit depth: " + std::to_string(codec_h.bit_depth));
+    }
+    bool wide = codec_h.bit_depth > 8;
+    m_maxval = (1 << codec_h.bit_depth) - 1;
+    m_near = codec_h.near;
+    if (m_near > 0) {
+        std::cout << "Near-lossless: NEAR = " << m_near << "\n";
+    }
+
+    BitStream bs(in_fs, STREAM_READ);
+    if (mode == CodingMode::SEQUENCE) {
+        decode_sequence(codec_h, bs);
+        bs.close();
+        return;
+    }
+
+    std::vector<int> palette;
+    if (codec_h.palette) {
+        palette.resize(static_cast<size_t>(bs.read_n_bits(8)) + 1);
+        for (int& level : palette) {
+            level = static_cast<int>(bs.read_n_bits(codec_h.maxval > 255 ? 16 : 8));
+        }
+        std::cout << "Palette: " << palette.size() << " grey levels\n";
+    }
+
+    Image img(codec_h.height, codec_h.width, wide ? 2 : 1, 1, codec_h.maxval);
+    m_decoded_scale = 1;
+
+    if (wide) {
+        decode_samples<uint16_t>(img, codec_h, bs);
+    } else {
+        decode_samples<uint8_t>(img, codec_h, bs);
+    }
+
+    bs.close();
+    in_fs.close();
+
+    if (m_thumbnail_scale > 1) {
+        if (m_decoded_scale == 1) {
+            std::cout << "Not a progressive file: decoded at full size before scaling.\n";
+        }
+        int s = m_thumbnail_scale;
+        Image thumb((img.rows + s - 1) / s, (img.cols + s - 1) / s, img.bytes_per_sample(), 1, img.maxval);
+        for (int r = 0; r < thumb.rows; ++r) {
+            for (int c = 0; c < thumb.cols; ++c) {
+                if (wide) thumb.at<uint16_t>(r, c) = img.at<uint16_t>(r * s, c * s);
+                else thumb.at<uint8_t>(r, c) = img.at<uint8_t>(r * s, c * s);
+            }
+        }
+        img = thumb;
+        std::cout << "Thumbnail: " << img.cols << "x" << img.rows << " (1/" << s << " scale)\n";
+    }
+
+    if (!palette.empty()) {
+        img = expand_palette(img, palette, codec_h.maxval);
+    }
+
+    write_pnm(m_out_file, img);
     std::cout << "Decoding complete. Saved to " << m_out_file << "\n";
 }
\ No newline at end of file
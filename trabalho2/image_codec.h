@@ -6,24 +6,60 @@
 #include <string>
 #include <vector>
 #include <fstream>
-#include <opencv2/opencv.hpp>
+#include "pnm_io.h"
+
+enum class CodingMode : uint8_t {
+    BLOCK_MED = 0,   // MED prediction, fixed or per-block 'm'
+    CONTEXT = 1,     // LOCO-I context modeling (JPEG-LS style) with run mode
+    BILEVEL = 2,     // JBIG-like binary context coding for two-level images
+    BLOCK_SELECT = 3,// Per-block choice among the predictors in predictors.h
+    PROGRESSIVE = 4, // Coarse-to-fine interpolative passes (thumbnail decoding)
+    WAVELET = 5,     // Reversible 5/3 wavelet, Golomb-coded subbands
+    SEQUENCE = 6,    // Numbered frames, predicted from the previous frame
+    WEIGHTED = 7,    // Self-correcting weighted predictor (JPEG XL style), online k
+    QUADTREE = 8     // Quadtree blocks, each with its own predictor and Rice k
+};
+
+class ContextModel;
 
 #pragma pack(push, 1)
 struct CodecHeader {
     char magic[4] = {'G', 'I', 'C', 'L'};
-    uint16_t version = 1;
+    uint16_t version = 8;
     uint32_t width;
     uint32_t height;
     bool adaptive;
     uint16_t fixed_m;
+    // Version 2
+    uint8_t mode = static_cast<uint8_t>(CodingMode::BLOCK_MED);
+    // Version 3: significant bits per sample (8, or 9-16 in a 16-bit container)
+    uint8_t bit_depth = 8;
+    // Version 4: PNM maxval of the source, restored on decoding
+    uint16_t maxval = 255;
+    // Version 5: JPEG-LS style NEAR bound (0 = lossless)
+    uint8_t near = 0;
+    // Version 6: samples are indices into a grey-level palette stored at
+    // the start of the bit stream
+    bool palette = false;
+    // Version 7: block modes derive a Golomb-Rice k per pixel from nearby
+    // residuals instead of sending 'm' per block
+    bool online_k = false;
+    // Version 8: block modes store every row as a byte-aligned substream
+    // behind a size table, so rows can be decoded in parallel
+    bool row_streams = false;
 };
 #pragma pack(pop)
 
 class ImageCodec {
 public:
-    ImageCodec(std::string in_file, std::string out_file, int m, bool adaptive);
+    ImageCodec(std::string in_file, std::string out_file, int m, bool adaptive,
+               CodingMode mode = CodingMode::BLOCK_MED, int near = 0, bool online_k = false,
+               bool row_streams = false);
     
-    ImageCodec(std::string in_file, std::string out_file);
+    // Decoder. With thumbnail_scale > 1 (a power of two) only a 1/scale
+    // image is produced; progressive files stop reading at that scale.
+    // Row-stream files are decoded by 'threads' threads (0 = one per core).
+    ImageCodec(std::string in_file, std::string out_file, int thumbnail_scale = 1, int threads = 0);
 
     void encode();
     void decode();
@@ -33,17 +69,87 @@ private:
     CodecHeader read_codec_header(std::fstream& fs);
     int calculate_m(const std::vector<int>& residuals);
 
-    int get_pixel(const cv::Mat& img, int r, int c);
+    // Sample-level coders, instantiated for uint8_t and uint16_t samples so
+    // the 8-bit path keeps its narrow loads.
+    template <typename T> int get_pixel(const Image& img, int r, int c);
     
     int predict(int A, int B, int C);
 
+    // Near-lossless residual quantization (identity when m_near == 0).
+    int quantize_residual(int residual);
+    int reconstruct_sample(int prediction, int residual);
+
+    int sample_bit_depth(const Image& img);
+    void wait_rows(int n);
+    template <typename T> void encode_samples(Image& img, CodingMode mode, const int levels[2], BitStream& bs);
+    template <typename T> void decode_samples(Image& img, const CodecHeader& header, BitStream& bs);
+
+    template <typename T> int choose_predictor(const Image& img, int r0, int r1);
+    template <typename T> void encode_blocks(Image& img, BitStream& bs, bool select_predictor);
+    template <typename T> void decode_blocks(Image& img, const CodecHeader& header, BitStream& bs);
+
+    template <typename T> void encode_rows(Image& img, BitStream& bs, bool select_predictor);
+    template <typename T> void decode_rows(Image& img, const CodecHeader& header, BitStream& bs);
+    void patch_row_sizes();
+
+    template <typename T> void encode_context(Image& img, BitStream& bs);
+    template <typename T> void decode_context(Image& img, BitStream& bs);
+    template <typename T> void context_neighbours(const Image& img, int r, int c, int& a, int& b, int& c_, int& d);
+    template <typename T> int encode_run(Image& img, int r, int c, ContextModel& model, BitStream& bs);
+    template <typename T> int decode_run(Image& img, int r, int c, ContextModel& model, BitStream& bs);
+
+    template <typename T> void encode_progressive(Image& img, BitStream& bs);
+    template <typename T> void decode_progressive(Image& img, const CodecHeader& header, BitStream& bs);
+
+    template <typename T> void encode_quadtree(Image& img, BitStream& bs);
+    template <typename T> void decode_quadtree(Image& img, const CodecHeader& header, BitStream& bs);
+
+    template <typename T> void encode_weighted(Image& img, BitStream& bs);
+    template <typename T> void decode_weighted(Image& img, const CodecHeader& header, BitStream& bs);
+
+    template <typename T> void encode_wavelet(const Image& img, BitStream& bs);
+    template <typename T> void decode_wavelet(Image& img, const CodecHeader& header, BitStream& bs);
+
+    // Sparse histograms: the grey levels in use become palette indices.
+    template <typename T> std::vector<int> build_palette(const Image& img);
+    template <typename T> Image apply_palette(const Image& img, const std::vector<int>& palette);
+    Image expand_palette(const Image& indices, const std::vector<int>& palette, int maxval);
+
+    // Sequence mode: the file names are printf-style patterns.
+    void encode_sequence();
+    void decode_sequence(const CodecHeader& header, BitStream& bs);
+    template <typename T> void encode_frame(Image& img, const Image* prev, BitStream& bs);
+    template <typename T> void decode_frame(Image& img, const Image* prev, const CodecHeader& header, BitStream& bs);
+
+    template <typename T> int count_levels(const Image& img, int levels[2]);
+    template <typename T> void encode_bilevel(const Image& img, const int levels[2], BitStream& bs);
+    template <typename T> void decode_bilevel(Image& img, BitStream& bs);
+
+    void print_mode(CodingMode mode, bool adaptive, int fixed_m, bool online_k = false);
+    template <typename T> void print_distortion(const Image& original, const Image& decoded);
+
     std::string m_in_file;
     std::string m_out_file;
     
     int m_fixed_m;
     bool m_adaptive;
+    bool m_online_k;
+    bool m_row_streams;
+    CodingMode m_mode;
+    int m_maxval;
+    int m_near;
+    int m_thumbnail_scale;
+    int m_threads;
+    int m_decoded_scale = 1;
+    GzPnmReader* m_stream = nullptr;  // set while encoding a .gz input
+    off_t m_row_table_pos = 0;        // row-stream size table, patched after encoding
+    std::vector<uint32_t> m_row_sizes;
 
     static const int BLOCK_SIZE_Y = 64;
+    static const int BILEVEL_CONTEXT_BITS = 10;
+    static const int PROGRESSIVE_LEVELS = 3;
+    static const int WAVELET_LEVELS = 5;
+    static const int ROW_PROGRESS_STEP = 32;  // samples between wavefront progress updates
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,278 @@
+#include "pnm_io.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Image counterpart of wav_cmp: per-channel MSE, PSNR, maximum absolute
+// error and SSIM between two PGM/PPM files, in one pass over both.
+//
+// SSIM is computed as in x264: 8x8 windows on a 4-pixel grid, each built
+// from four 4x4 blocks, so every sample is read once and all the per-row
+// work runs over contiguous interleaved samples, in loops the compiler
+// vectorizes. Threads take bands of 4-row blocks.
+
+static const int SSIM_BLOCK = 4;
+
+struct ChannelStats {
+    double sse = 0.0;
+    int max_err = 0;
+    double ssim_sum = 0.0;
+    long ssim_windows = 0;
+};
+
+// Sums over one 4x4 block of one channel.
+struct BlockSums {
+    double s1, s2, ss, s12;
+};
+
+static double ssim_window(const BlockSums* top, const BlockSums* bottom, int channels, double c1, double c2) {
+    double s1 = top[0].s1 + top[channels].s1 + bottom[0].s1 + bottom[channels].s1;
+    double s2 = top[0].s2 + top[channels].s2 + bottom[0].s2 + bottom[channels].s2;
+    double ss = top[0].ss + top[channels].ss + bottom[0].ss + bottom[channels].ss;
+    double s12 = top[0].s12 + top[channels].s12 + bottom[0].s12 + bottom[channels].s12;
+    double vars = ss * 64 - s1 * s1 - s2 * s2;
+    double covar = s12 * 64 - s1 * s2;
+    return (2 * s1 * s2 + c1) * (2 * covar + c2) / ((s1 * s1 + s2 * s2 + c1) * (vars + c2));
+}
+
+template <typename T>
+class Comparator {
+public:
+    // 8-bit sums over four rows fit in 32 bits; 16-bit ones do not.
+    using Acc = std::conditional_t<sizeof(T) == 1, int32_t, int64_t>;
+
+    Comparator(const Image& a, const Image& b)
+        : m_a(a), m_b(b), m_channels(a.channels), m_n(static_cast<size_t>(a.cols) * a.channels),
+          m_block_rows((a.rows + SSIM_BLOCK - 1) / SSIM_BLOCK), m_block_cols(a.cols / SSIM_BLOCK) {
+        double peak = static_cast<double>(std::max(a.maxval, b.maxval));
+        m_c1 = 0.01 * 0.01 * peak * peak * 64;
+        m_c2 = 0.03 * 0.03 * peak * peak * 64 * 63;
+    }
+
+    std::vector<ChannelStats> run(int threads) {
+        threads = std::max(1, std::min(threads, m_block_rows));
+        std::vector<std::vector<ChannelStats>> partial(threads, std::vector<ChannelStats>(m_channels));
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; ++t) {
+            int b0 = static_cast<int>(static_cast<long>(m_block_rows) * t / threads);
+            int b1 = static_cast<int>(static_cast<long>(m_block_rows) * (t + 1) / threads);
+            workers.emplace_back([this, b0, b1, &partial, t] { band(b0, b1, partial[t]); });
+        }
+        for (auto& worker : workers) worker.join();
+
+        std::vector<ChannelStats> total(m_channels);
+        for (const auto& p : partial) {
+            for (int ch = 0; ch < m_channels; ++ch) {
+                total[ch].sse += p[ch].sse;
+                total[ch].max_err = std::max(total[ch].max_err, p[ch].max_err);
+                total[ch].ssim_sum += p[ch].ssim_sum;
+                total[ch].ssim_windows += p[ch].ssim_windows;
+            }
+        }
+        return total;
+    }
+
+private:
+    // Block rows [b0, b1) count towards the error; block row b1 is also
+    // summed (but not counted) so the windows straddling the band edge are
+    // not lost.
+    void band(int b0, int b1, std::vector<ChannelStats>& stats) {
+        std::vector<Acc> s1(m_n), s2(m_n), ss(m_n), s12(m_n), se(m_n);
+        std::vector<int> err(m_n);
+        std::vector<BlockSums> prev(static_cast<size_t>(m_block_cols) * m_channels);
+        std::vector<BlockSums> cur(prev.size());
+        bool have_prev = false;
+
+        for (int by = b0; by <= b1 && by < m_block_rows; ++by) {
+            const bool counted = by < b1;
+            const int r0 = by * SSIM_BLOCK;
+            const int r1 = std::min(r0 + SSIM_BLOCK, m_a.rows);
+            std::fill(s1.begin(), s1.end(), 0);
+            std::fill(s2.begin(), s2.end(), 0);
+            std::fill(ss.begin(), ss.end(), 0);
+            std::fill(s12.begin(), s12.end(), 0);
+            std::fill(se.begin(), se.end(), 0);
+            std::fill(err.begin(), err.end(), 0);
+
+            for (int r = r0; r < r1; ++r) {
+                const T* a = m_a.ptr<T>(r);
+                const T* b = m_b.ptr<T>(r);
+                // Two loops rather than one: with six accumulators beside the
+                // two rows, GCC needs more run-time alias checks than it will
+                // emit and leaves the single 8-bit loop scalar.
+                for (size_t i = 0; i < m_n; ++i) {
+                    Acc x = a[i];
+                    Acc y = b[i];
+                    s1[i] += x;
+                    s2[i] += y;
+                    ss[i] += x * x + y * y;
+                    s12[i] += x * y;
+                }
+                for (size_t i = 0; i < m_n; ++i) {
+                    Acc e = static_cast<Acc>(a[i]) - b[i];
+                    se[i] += e * e;
+                    err[i] = std::max(err[i], static_cast<int>(e < 0 ? -e : e));
+                }
+            }
+
+            if (counted) {
+                for (size_t i = 0; i < m_n; ++i) {
+                    ChannelStats& st = stats[i % m_channels];
+                    st.sse += static_cast<double>(se[i]);
+                    st.max_err = std::max(st.max_err, err[i]);
+                }
+            }
+
+            // SSIM only uses whole 4x4 blocks.
+            if (r1 - r0 < SSIM_BLOCK) break;
+            for (int bx = 0; bx < m_block_cols; ++bx) {
+                for (int ch = 0; ch < m_channels; ++ch) {
+                    BlockSums& bs = cur[static_cast<size_t>(bx) * m_channels + ch];
+                    bs = { 0, 0, 0, 0 };
+                    for (int x = bx * SSIM_BLOCK; x < (bx + 1) * SSIM_BLOCK; ++x) {
+                        size_t i = static_cast<size_t>(x) * m_channels + ch;
+                        bs.s1 += static_cast<double>(s1[i]);
+                        bs.s2 += static_cast<double>(s2[i]);
+                        bs.ss += static_cast<double>(ss[i]);
+                        bs.s12 += static_cast<double>(s12[i]);
+                    }
+                }
+            }
+            if (have_prev) {
+                // The window between block rows by - 1 and by belongs to the
+                // band that counts block row by - 1.
+                for (int bx = 0; bx + 1 < m_block_cols; ++bx) {
+                    for (int ch = 0; ch < m_channels; ++ch) {
+                        size_t i = static_cast<size_t>(bx) * m_channels + ch;
+                        stats[ch].ssim_sum += ssim_window(&prev[i], &cur[i], m_channels, m_c1, m_c2);
+                        stats[ch].ssim_windows++;
+                    }
+                }
+            }
+            std::swap(prev, cur);
+            have_prev = true;
+        }
+    }
+
+    const Image& m_a;
+    const Image& m_b;
+    int m_channels;
+    size_t m_n;
+    int m_block_rows;
+    int m_block_cols;
+    double m_c1, m_c2;
+};
+
+static Image load(const std::string& path) {
+    if (is_gzip_path(path)) {
+        GzPnmReader reader(path);
+        reader.wait_rows(reader.image().rows);
+        return reader.image();
+    }
+    return read_pnm(path);
+}
+
+static void print_stats(const std::string& label, const ChannelStats& st, double samples, int maxval) {
+    double mse = st.sse / samples;
+    std::cout << label << ":\n";
+    std::cout << "  MSE:           " << std::fixed << std::setprecision(4) << mse << "\n";
+    if (mse == 0.0) {
+        std::cout << "  PSNR:          inf dB\n";
+    } else {
+        double peak = static_cast<double>(maxval);
+        std::cout << "  PSNR:          " << std::setprecision(2) << 10.0 * std::log10(peak * peak / mse) << " dB\n";
+    }
+    std::cout << "  Max abs error: " << st.max_err << "\n";
+    if (st.ssim_windows > 0) {
+        std::cout << "  SSIM:          " << std::setprecision(6) << st.ssim_sum / st.ssim_windows << "\n";
+    } else {
+        std::cout << "  SSIM:          n/a (image smaller than 8x8)\n";
+    }
+}
+
+void print_usage() {
+    std::cerr << "Usage: img_cmp [options] <original.ppm> <processed.ppm>\n\n"
+              << "Compares two PGM/PPM images (also .gz) of the same size and channels.\n\n"
+              << "Options:\n"
+              << "  -l             Lossless check: exit with 2 if any sample differs\n"
+              << "  --near <N>     Near-lossless check: exit with 2 if any error exceeds N\n"
+              << "  -j <threads>   Worker threads (default: one per core)\n"
+              << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> files;
+    int tolerance = -1;
+    int threads = static_cast<int>(std::thread::hardware_concurrency());
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-l") {
+            tolerance = 0;
+        } else if (arg == "--near" && i + 1 < argc) {
+            tolerance = std::stoi(argv[++i]);
+        } else if (arg == "-j" && i + 1 < argc) {
+            threads = std::stoi(argv[++i]);
+        } else if (!arg.empty() && arg[0] == '-') {
+            print_usage();
+            return 1;
+        } else {
+            files.push_back(arg);
+        }
+    }
+    if (files.size() != 2) {
+        print_usage();
+        return 1;
+    }
+
+    try {
+        Image a = load(files[0]);
+        Image b = load(files[1]);
+        if (a.rows != b.rows || a.cols != b.cols || a.channels != b.channels) {
+            std::cerr << "Error: images differ in size or channels (" << a.cols << "x" << a.rows << "x"
+                      << a.channels << " vs " << b.cols << "x" << b.rows << "x" << b.channels << ")\n";
+            return 2;
+        }
+        if (a.bytes_per_sample() != b.bytes_per_sample()) {
+            std::cerr << "Error: images differ in sample depth\n";
+            return 2;
+        }
+
+        std::vector<ChannelStats> stats = a.wide() ? Comparator<uint16_t>(a, b).run(threads)
+                                                   : Comparator<uint8_t>(a, b).run(threads);
+
+        const double samples = static_cast<double>(a.rows) * a.cols;
+        const int maxval = std::max(a.maxval, b.maxval);
+        static const char* RGB[] = { "R", "G", "B" };
+        ChannelStats all;
+        for (int ch = 0; ch < a.channels; ++ch) {
+            std::string label = "Channel " + std::to_string(ch);
+            if (a.channels == 3) label += std::string(" (") + RGB[ch] + ")";
+            print_stats(label, stats[ch], samples, maxval);
+            all.sse += stats[ch].sse;
+            all.max_err = std::max(all.max_err, stats[ch].max_err);
+            all.ssim_sum += stats[ch].ssim_sum;
+            all.ssim_windows += stats[ch].ssim_windows;
+        }
+        if (a.channels > 1) {
+            print_stats("All channels", all, samples * a.channels, maxval);
+        }
+
+        if (tolerance >= 0 && all.max_err > tolerance) {
+            std::cerr << (tolerance == 0 ? "Images are not identical" : "Error exceeds the tolerance")
+                      << " (max abs error " << all.max_err << ")\n";
+            return 2;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "An error occurred: " << e.what() << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,318 @@
+#include "pnm_io.h"
+#include <stdexcept>
+#include <cctype>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+Image::Image(int rows, int cols, int bytes_per_sample, int channels, int maxval)
+    : rows(rows), cols(cols), channels(channels), m_bytes_per_sample(bytes_per_sample) {
+    if (bytes_per_sample != 1 && bytes_per_sample != 2) {
+        throw std::invalid_argument("Samples must be 1 or 2 bytes wide.");
+    }
+    this->maxval = (maxval > 0) ? maxval : (bytes_per_sample == 2 ? 65535 : 255);
+    size_t size = row_bytes() * rows;
+    m_storage = std::shared_ptr<uint8_t>(new uint8_t[size > 0 ? size : 1], std::default_delete<uint8_t[]>());
+    m_data = m_storage.get();
+}
+
+Image Image::clone() const {
+    Image copy(rows, cols, m_bytes_per_sample, channels, maxval);
+    if (!empty()) {
+        std::memcpy(copy.m_data, m_data, row_bytes() * rows);
+    }
+    return copy;
+}
+
+// Read-only view of a whole file, unmapped when the last owner goes away.
+static std::shared_ptr<uint8_t> map_file(const std::string& path, size_t& size) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open image: " + path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        throw std::runtime_error("Could not read image: " + path);
+    }
+    size = static_cast<size_t>(st.st_size);
+    void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        throw std::runtime_error("Could not map image: " + path);
+    }
+    return std::shared_ptr<uint8_t>(static_cast<uint8_t*>(addr), [size](uint8_t* p) { munmap(p, size); });
+}
+
+static int parse_header_value(const uint8_t* data, size_t size, size_t& pos) {
+    while (pos < size) {
+        if (data[pos] == '#') {
+            while (pos < size && data[pos] != '\n') pos++;
+        } else if (std::isspace(data[pos])) {
+            pos++;
+        } else {
+            break;
+        }
+    }
+    if (pos >= size || !std::isdigit(data[pos])) {
+        throw std::runtime_error("Malformed PNM header.");
+    }
+    long value = 0;
+    while (pos < size && std::isdigit(data[pos])) {
+        value = value * 10 + (data[pos++] - '0');
+        if (value > (1L << 30)) {
+            throw std::runtime_error("Malformed PNM header.");
+        }
+    }
+    return static_cast<int>(value);
+}
+
+static inline int gray_of(int r, int g, int b) {
+    return (r * 4899 + g * 9617 + b * 1868 + (1 << 13)) >> 14;
+}
+
+// Parses "P5|P6 <width> <height> <maxval>" and the single whitespace that
+// precedes the raster, leaving 'pos' at the first sample.
+static PnmInfo parse_header(const uint8_t* data, size_t size, size_t& pos, const std::string& path) {
+    if (size < 2 || data[0] != 'P' || (data[1] != '5' && data[1] != '6')) {
+        throw std::runtime_error("Only binary PGM (P5) and PPM (P6) files are supported: " + path);
+    }
+    PnmInfo info;
+    info.channels = (data[1] == '6') ? 3 : 1;
+    pos = 2;
+    info.width = parse_header_value(data, size, pos);
+    info.height = parse_header_value(data, size, pos);
+    info.maxval = parse_header_value(data, size, pos);
+    if (pos >= size) {
+        throw std::runtime_error("Malformed PNM header: " + path);
+    }
+    pos++;
+
+    if (info.width <= 0 || info.height <= 0 || info.maxval <= 0 || info.maxval > 65535) {
+        throw std::runtime_error("Invalid PNM dimensions or maxval: " + path);
+    }
+    info.bytes_per_sample = (info.maxval > 255) ? 2 : 1;
+    return info;
+}
+
+// Converts 'nrows' raw PNM rows starting at image row 'row0': big-endian
+// 16-bit samples are swapped and RGB is reduced to gray when the image has
+// one channel but the file has three.
+static void convert_rows(const uint8_t* src, const PnmInfo& info, Image& img, int row0, int nrows) {
+    size_t pixels = static_cast<size_t>(info.width) * nrows;
+    if (info.bytes_per_sample == 1) {
+        uint8_t* dst = img.ptr<uint8_t>(row0);
+        if (img.channels == info.channels) {
+            std::memcpy(dst, src, pixels * info.channels);
+            return;
+        }
+        for (size_t i = 0; i < pixels; ++i, src += 3) {
+            dst[i] = static_cast<uint8_t>(gray_of(src[0], src[1], src[2]));
+        }
+        return;
+    }
+
+    uint16_t* dst = img.ptr<uint16_t>(row0);
+    auto sample = [](const uint8_t* p) { return (p[0] << 8) | p[1]; };
+    if (img.channels == info.channels) {
+        for (size_t i = 0; i < pixels * info.channels; ++i, src += 2) {
+            dst[i] = static_cast<uint16_t>(sample(src));
+        }
+    } else {
+        for (size_t i = 0; i < pixels; ++i, src += 6) {
+            dst[i] = static_cast<uint16_t>(gray_of(sample(src), sample(src + 2), sample(src + 4)));
+        }
+    }
+}
+
+Image read_pnm(const std::string& path, bool to_gray) {
+    size_t size;
+    std::shared_ptr<uint8_t> file = map_file(path, size);
+    const uint8_t* data = file.get();
+
+    size_t pos;
+    PnmInfo info = parse_header(data, size, pos, path);
+    if (pos + info.raster_bytes() > size) {
+        throw std::runtime_error("Truncated PNM file: " + path);
+    }
+
+    int out_channels = (to_gray && info.channels == 3) ? 1 : info.channels;
+    if (info.bytes_per_sample == 1 && out_channels == info.channels) {
+        Image img;
+        img.rows = info.height;
+        img.cols = info.width;
+        img.channels = info.channels;
+        img.maxval = info.maxval;
+        img.m_bytes_per_sample = 1;
+        img.m_storage = file;
+        img.m_data = file.get() + pos;
+        return img;
+    }
+
+    Image img(info.height, info.width, info.bytes_per_sample, out_channels, info.maxval);
+    convert_rows(data + pos, info, img, 0, info.height);
+    return img;
+}
+
+GzPnmReader::GzPnmReader(const std::string& path, bool to_gray) : m_path(path) {
+    m_gz = gzopen(path.c_str(), "rb");
+    if (!m_gz) {
+        throw std::runtime_error("Could not open image: " + path);
+    }
+    gzbuffer(m_gz, GZ_CHUNK);
+
+    // The header is parsed from the first inflated chunk; whatever follows
+    // it is the start of the raster and is handed to the worker thread.
+    std::vector<uint8_t> head(GZ_CHUNK);
+    int n = gzread(m_gz, head.data(), GZ_CHUNK);
+    if (n <= 0) {
+        gzclose(m_gz);
+        throw std::runtime_error("Could not read image: " + path);
+    }
+    size_t pos;
+    try {
+        m_info = parse_header(head.data(), static_cast<size_t>(n), pos, path);
+    } catch (...) {
+        gzclose(m_gz);
+        throw;
+    }
+    m_pending.assign(head.begin() + pos, head.begin() + n);
+    m_inflated = static_cast<size_t>(n);
+
+    int out_channels = (to_gray && m_info.channels == 3) ? 1 : m_info.channels;
+    m_image = Image(m_info.height, m_info.width, m_info.bytes_per_sample, out_channels, m_info.maxval);
+    m_thread = std::thread(&GzPnmReader::run, this);
+}
+
+GzPnmReader::~GzPnmReader() {
+    m_stop = true;
+    if (m_thread.joinable()) m_thread.join();
+    gzclose(m_gz);
+}
+
+void GzPnmReader::run() {
+    try {
+        const size_t row_size = static_cast<size_t>(m_info.width) * m_info.channels * m_info.bytes_per_sample;
+        const int band = std::max(1, static_cast<int>(GZ_CHUNK / row_size));
+        std::vector<uint8_t> raw(row_size * band);
+        int row = 0;
+
+        while (row < m_info.height && !m_stop) {
+            int nrows = std::min(band, m_info.height - row);
+            size_t want = row_size * nrows;
+            size_t have = std::min(want, m_pending.size());
+            std::memcpy(raw.data(), m_pending.data(), have);
+            m_pending.erase(m_pending.begin(), m_pending.begin() + have);
+
+            while (have < want) {
+                int n = gzread(m_gz, raw.data() + have, static_cast<unsigned>(want - have));
+                if (n <= 0) {
+                    throw std::runtime_error("Truncated PNM file: " + m_path);
+                }
+                have += static_cast<size_t>(n);
+                m_inflated += static_cast<size_t>(n);
+            }
+
+            convert_rows(raw.data(), m_info, m_image, row, nrows);
+            row += nrows;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_rows_ready = row;
+            }
+            m_cv.notify_all();
+        }
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_error = std::current_exception();
+        m_cv.notify_all();
+    }
+}
+
+void GzPnmReader::wait_rows(int n) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [&] { return m_rows_ready >= n || m_error; });
+    if (m_error) std::rethrow_exception(m_error);
+}
+
+size_t GzPnmReader::inflated_size() {
+    wait_rows(m_info.height);
+    return m_inflated;
+}
+
+bool is_gzip_path(const std::string& path) {
+    return path.size() > 3 && path.compare(path.size() - 3, 3, ".gz") == 0;
+}
+
+PnmInfo read_pnm_header(const std::string& path, size_t& raster_offset) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open image: " + path);
+    }
+    // Headers are a few dozen bytes; this leaves room for long comments.
+    std::vector<uint8_t> head(1 << 16);
+    ssize_t got = ::pread(fd, head.data(), head.size(), 0);
+    struct stat st;
+    bool stat_ok = fstat(fd, &st) == 0;
+    ::close(fd);
+    if (got <= 0 || !stat_ok) {
+        throw std::runtime_error("Could not read image: " + path);
+    }
+
+    PnmInfo info = parse_header(head.data(), static_cast<size_t>(got), raster_offset, path);
+    if (raster_offset + info.raster_bytes() > static_cast<size_t>(st.st_size)) {
+        throw std::runtime_error("Truncated PNM file: " + path);
+    }
+    return info;
+}
+
+std::string pnm_header(const PnmInfo& info) {
+    return std::string(info.channels == 3 ? "P6" : "P5") + "\n" + std::to_string(info.width) + " " +
+           std::to_string(info.height) + "\n" + std::to_string(info.maxval) + "\n";
+}
+
+void write_pnm(const std::string& path, const Image& img) {
+    if (img.channels != 1 && img.channels != 3) {
+        throw std::runtime_error("PNM output needs 1 or 3 channels.");
+    }
+    PnmInfo info;
+    info.width = img.cols;
+    info.height = img.rows;
+    info.channels = img.channels;
+    info.maxval = img.maxval;
+    std::string header = pnm_header(info);
+    size_t raster = img.row_bytes() * img.rows;
+    size_t size = header.size() + raster;
+
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        throw std::runtime_error("Could not create image: " + path);
+    }
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+        ::close(fd);
+        throw std::runtime_error("Could not write image: " + path);
+    }
+    void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        throw std::runtime_error("Could not map image: " + path);
+    }
+
+    uint8_t* out = static_cast<uint8_t*>(addr);
+    std::memcpy(out, header.data(), header.size());
+    out += header.size();
+    if (img.wide()) {
+        const uint16_t* src = reinterpret_cast<const uint16_t*>(img.data());
+        size_t samples = raster / 2;
+        for (size_t i = 0; i < samples; ++i) {
+            out[2 * i] = static_cast<uint8_t>(src[i] >> 8);
+            out[2 * i + 1] = static_cast<uint8_t>(src[i] & 0xFF);
+        }
+    } else {
+        std::memcpy(out, img.data(), raster);
+    }
+    munmap(addr, size);
+}
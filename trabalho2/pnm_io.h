@@ -0,0 +1,129 @@
+#ifndef PNM_IO_H
+#define PNM_IO_H
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+
+// Geometry and sample format from a PNM header.
+struct PnmInfo {
+    int width = 0;
+    int height = 0;
+    int channels = 1;
+    int maxval = 255;
+    int bytes_per_sample = 1;
+
+    size_t raster_bytes() const {
+        return static_cast<size_t>(width) * height * channels * bytes_per_sample;
+    }
+};
+
+// Interleaved image buffer with 8-bit or 16-bit samples. Rows are stored
+// contiguously; 'maxval' keeps the PNM sample range so it survives a round
+// trip.
+class Image {
+public:
+    Image() = default;
+    Image(int rows, int cols, int bytes_per_sample, int channels = 1, int maxval = -1);
+
+    int rows = 0;
+    int cols = 0;
+    int channels = 1;
+    int maxval = 255;
+
+    int bytes_per_sample() const { return m_bytes_per_sample; }
+    bool wide() const { return m_bytes_per_sample == 2; }
+    bool empty() const { return m_data == nullptr; }
+    // Copies share the pixels; clone() gives an independent buffer.
+    Image clone() const;
+    size_t row_bytes() const { return static_cast<size_t>(cols) * channels * m_bytes_per_sample; }
+
+    uint8_t* data() { return m_data; }
+    const uint8_t* data() const { return m_data; }
+
+    template <typename T> T* ptr(int r) {
+        return reinterpret_cast<T*>(m_data + r * row_bytes());
+    }
+    template <typename T> const T* ptr(int r) const {
+        return reinterpret_cast<const T*>(m_data + r * row_bytes());
+    }
+    template <typename T> T& at(int r, int c) { return ptr<T>(r)[c]; }
+    template <typename T> const T& at(int r, int c) const { return ptr<T>(r)[c]; }
+
+private:
+    friend Image read_pnm(const std::string& path, bool to_gray);
+
+    int m_bytes_per_sample = 1;
+    std::shared_ptr<uint8_t> m_storage;  // owns the heap buffer or the mapping
+    uint8_t* m_data = nullptr;
+};
+
+// Reads a binary PGM (P5) or PPM (P6) file through mmap. 8-bit files that
+// need no conversion are used in place (copy-on-write mapping); 16-bit
+// samples are converted from big-endian. With to_gray, P6 images are
+// converted to one channel with the usual ITU-R BT.601 weights.
+Image read_pnm(const std::string& path, bool to_gray = false);
+
+// Writes a P5 (one channel) or P6 (three channels) file through mmap.
+void write_pnm(const std::string& path, const Image& img);
+
+// Parses only the header of a binary PGM/PPM file, for callers that stream
+// the raster themselves; 'raster_offset' is set to the first sample.
+PnmInfo read_pnm_header(const std::string& path, size_t& raster_offset);
+
+// "P5|P6\n<width> <height>\n<maxval>\n" for 'info'.
+std::string pnm_header(const PnmInfo& info);
+
+bool is_gzip_path(const std::string& path);
+
+// Streaming reader for gzip-compressed PNM files (.ppm.gz / .pgm.gz). The
+// header is parsed in the constructor, which also allocates the image; a
+// worker thread then inflates the raster in bands and publishes how many
+// rows are ready, so callers can start on the top of the image while the
+// rest is still being decompressed.
+class GzPnmReader {
+public:
+    GzPnmReader(const std::string& path, bool to_gray = false);
+    ~GzPnmReader();
+
+    GzPnmReader(const GzPnmReader&) = delete;
+    GzPnmReader& operator=(const GzPnmReader&) = delete;
+
+    // The image is filled top to bottom; rows past wait_rows() are undefined.
+    Image& image() { return m_image; }
+
+    // Blocks until at least n rows are available. Rethrows decoding errors.
+    void wait_rows(int n);
+
+    // Uncompressed size of the file, once everything has been inflated.
+    size_t inflated_size();
+
+private:
+    void run();
+
+    static const unsigned GZ_CHUNK = 1 << 16;
+
+    std::string m_path;
+    gzFile m_gz = nullptr;
+    PnmInfo m_info;
+    Image m_image;
+    std::vector<uint8_t> m_pending;
+    size_t m_inflated = 0;
+
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    int m_rows_ready = 0;
+    std::exception_ptr m_error;
+    std::atomic<bool> m_stop { false };
+};
+
+#endif
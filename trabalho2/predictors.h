@@ -0,0 +1,118 @@
+#ifndef PREDICTORS_H
+#define PREDICTORS_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <utility>
+
+// Causal neighbours of the current pixel X:
+//
+//          NN  NNE
+//     NW   N   NE
+// WW  W    X
+//
+// Samples outside the image read as 0.
+struct Neighbourhood {
+    int w, n, nw, ne, ww, nn, nne;
+};
+
+// Predictors selectable per block: the seven lossless JPEG predictors,
+// MED (LOCO-I) and CALIC's gradient-adjusted predictor (GAP).
+enum Predictor {
+    PRED_W = 0,             // JPEG 1: W
+    PRED_N = 1,             // JPEG 2: N
+    PRED_NW = 2,            // JPEG 3: NW
+    PRED_PLANE = 3,         // JPEG 4: W + N - NW
+    PRED_W_GRAD = 4,        // JPEG 5: W + (N - NW) / 2
+    PRED_N_GRAD = 5,        // JPEG 6: N + (W - NW) / 2
+    PRED_AVG = 6,           // JPEG 7: (W + N) / 2
+    PRED_MED = 7,
+    PRED_GAP = 8,
+    NUM_PREDICTORS = 9
+};
+
+const int PREDICTOR_BITS = 4;
+
+template <int P>
+inline int predict_fixed(const Neighbourhood& nb, int maxval) {
+    int p;
+    if constexpr (P == PRED_W) {
+        p = nb.w;
+    } else if constexpr (P == PRED_N) {
+        p = nb.n;
+    } else if constexpr (P == PRED_NW) {
+        p = nb.nw;
+    } else if constexpr (P == PRED_PLANE) {
+        p = nb.w + nb.n - nb.nw;
+    } else if constexpr (P == PRED_W_GRAD) {
+        p = nb.w + ((nb.n - nb.nw) >> 1);
+    } else if constexpr (P == PRED_N_GRAD) {
+        p = nb.n + ((nb.w - nb.nw) >> 1);
+    } else if constexpr (P == PRED_AVG) {
+        p = (nb.w + nb.n) >> 1;
+    } else if constexpr (P == PRED_MED) {
+        // Median of W, N and W + N - NW, written without branches.
+        p = std::max(std::min(nb.w, nb.n), std::min(std::max(nb.w, nb.n), nb.w + nb.n - nb.nw));
+    } else {
+        int dh = std::abs(nb.w - nb.ww) + std::abs(nb.n - nb.nw) + std::abs(nb.n - nb.ne);
+        int dv = std::abs(nb.w - nb.nw) + std::abs(nb.n - nb.nn) + std::abs(nb.ne - nb.nne);
+        int diff = dv - dh;
+        // GAP thresholds are tuned for 8-bit samples; scale them with depth.
+        int scale = (maxval + 1) >> 8;
+        if (scale < 1) scale = 1;
+        // Selects rather than branches, so that row_costs still vectorizes:
+        // a later select overrides an earlier one, so the thresholds go
+        // from the innermost outwards.
+        int g = ((nb.w + nb.n) >> 1) + ((nb.ne - nb.nw) >> 2);
+        p = g;
+        p = (diff < -8 * scale) ? (3 * g + nb.n) >> 2 : p;
+        p = (diff < -32 * scale) ? (g + nb.n) >> 1 : p;
+        p = (diff > 8 * scale) ? (3 * g + nb.w) >> 2 : p;
+        p = (diff > 32 * scale) ? (g + nb.w) >> 1 : p;
+        p = (diff < -80 * scale) ? nb.n : p;
+        p = (diff > 80 * scale) ? nb.w : p;
+    }
+    return std::clamp(p, 0, maxval);
+}
+
+inline int predict_with(int predictor, const Neighbourhood& nb, int maxval) {
+    switch (predictor) {
+        case PRED_W: return predict_fixed<PRED_W>(nb, maxval);
+        case PRED_N: return predict_fixed<PRED_N>(nb, maxval);
+        case PRED_NW: return predict_fixed<PRED_NW>(nb, maxval);
+        case PRED_PLANE: return predict_fixed<PRED_PLANE>(nb, maxval);
+        case PRED_W_GRAD: return predict_fixed<PRED_W_GRAD>(nb, maxval);
+        case PRED_N_GRAD: return predict_fixed<PRED_N_GRAD>(nb, maxval);
+        case PRED_AVG: return predict_fixed<PRED_AVG>(nb, maxval);
+        case PRED_MED: return predict_fixed<PRED_MED>(nb, maxval);
+        default: return predict_fixed<PRED_GAP>(nb, maxval);
+    }
+}
+
+// Sum of |X - P| over one row for every predictor at once, added to
+// costs[]: each neighbourhood is loaded once and scored nine times. The
+// rows are padded with two zero samples on each side, so the loop has no
+// edge branches and the compiler can vectorize it. |X - P| <= maxval <
+// 2^16, so int sums over ROW_COST_CHUNK columns cannot overflow (nine long
+// sums would keep the loop scalar).
+const int ROW_COST_CHUNK = 1 << 14;
+
+template <int... P>
+inline void row_costs(const int* cur, const int* up, const int* up2, int cols, int maxval, long* costs,
+                      std::integer_sequence<int, P...>) {
+    for (int c0 = 0; c0 < cols; c0 += ROW_COST_CHUNK) {
+        const int c1 = std::min(cols, c0 + ROW_COST_CHUNK);
+        int sum[sizeof...(P)] = {};
+        for (int c = c0; c < c1; ++c) {
+            Neighbourhood nb { cur[c - 1], up[c], up[c - 1], up[c + 1], cur[c - 2], up2[c], up2[c + 1] };
+            ((sum[P] += std::abs(cur[c] - predict_fixed<P>(nb, maxval))), ...);
+        }
+        for (size_t p = 0; p < sizeof...(P); ++p) costs[p] += sum[p];
+    }
+}
+
+inline void row_costs(const int* cur, const int* up, const int* up2, int cols, int maxval, long* costs) {
+    row_costs(cur, up, up2, cols, maxval, costs, std::make_integer_sequence<int, NUM_PREDICTORS>());
+}
+
+#endif
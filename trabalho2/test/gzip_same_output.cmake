@@ -0,0 +1,29 @@
+# Encodes IMAGE and IMAGE.gz with the same OPTIONS and fails unless both
+# GICL files are identical: streaming a gzip input must not change what
+# the encoder decides (palette, predictors, parameters).
+#
+#   cmake -DCODEC=<image_golomb_codec> -DIMAGE=<file.ppm> -DOPTIONS="-a;-p"
+#         -DWORK_DIR=<dir> -P gzip_same_output.cmake
+
+file(MAKE_DIRECTORY ${WORK_DIR})
+foreach(input IN ITEMS ${IMAGE} ${IMAGE}.gz)
+    if(input MATCHES "\\.gz$")
+        set(output ${WORK_DIR}/gz.gicl)
+    else()
+        set(output ${WORK_DIR}/raw.gicl)
+    endif()
+    execute_process(COMMAND ${CODEC} -e ${input} -o ${output} ${OPTIONS}
+                    RESULT_VARIABLE result OUTPUT_QUIET)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "Encoding ${input} failed (${result})")
+    endif()
+endforeach()
+
+file(SIZE ${WORK_DIR}/raw.gicl raw_size)
+file(SIZE ${WORK_DIR}/gz.gicl gz_size)
+execute_process(COMMAND ${CMAKE_COMMAND} -E compare_files ${WORK_DIR}/raw.gicl ${WORK_DIR}/gz.gicl
+                RESULT_VARIABLE differ)
+if(NOT differ EQUAL 0)
+    message(FATAL_ERROR "${IMAGE} (${OPTIONS}): ${raw_size} bytes raw, ${gz_size} bytes from .gz")
+endif()
+message(STATUS "${IMAGE} (${OPTIONS}): ${raw_size} bytes either way")
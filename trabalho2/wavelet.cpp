@@ -0,0 +1,167 @@
+#include "wavelet.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+// Columns are lifted in strips of this many samples: each strip is gathered
+// into a contiguous buffer so the lifting loops run over unit-stride rows
+// (and vectorize) while the strip of a tall band still fits in cache.
+// Every lifting loop here is vectorized by the compiler at -O3; the
+// transform is a small part of a wavelet encode (the Golomb coding of the
+// subbands dominates), so there is no hand-written SIMD version.
+static const int COLUMN_STRIP = 64;
+
+static void lift_row_forward(int32_t* x, int n, int32_t* tmp) {
+    const int ns = (n + 1) / 2;
+    const int nd = n / 2;
+    int32_t* s = tmp;
+    int32_t* d = tmp + ns;
+
+    for (int i = 0; i < nd; ++i) {
+        s[i] = x[2 * i];
+        d[i] = x[2 * i + 1];
+    }
+    if (ns > nd) s[ns - 1] = x[n - 1];
+
+    // Predict: the odd samples become the high-pass band.
+    for (int i = 0; i < ns - 1; ++i) d[i] -= (s[i] + s[i + 1]) >> 1;
+    if (nd == ns) d[nd - 1] -= s[nd - 1];
+
+    // Update: the even samples become the low-pass band.
+    s[0] += (2 * d[0] + 2) >> 2;
+    for (int i = 1; i < nd; ++i) s[i] += (d[i - 1] + d[i] + 2) >> 2;
+    if (ns > nd) s[ns - 1] += (2 * d[nd - 1] + 2) >> 2;
+
+    std::memcpy(x, tmp, sizeof(int32_t) * n);
+}
+
+static void lift_row_inverse(int32_t* x, int n, int32_t* tmp) {
+    const int ns = (n + 1) / 2;
+    const int nd = n / 2;
+    std::memcpy(tmp, x, sizeof(int32_t) * n);
+    int32_t* s = tmp;
+    int32_t* d = tmp + ns;
+
+    s[0] -= (2 * d[0] + 2) >> 2;
+    for (int i = 1; i < nd; ++i) s[i] -= (d[i - 1] + d[i] + 2) >> 2;
+    if (ns > nd) s[ns - 1] -= (2 * d[nd - 1] + 2) >> 2;
+
+    for (int i = 0; i < ns - 1; ++i) d[i] += (s[i] + s[i + 1]) >> 1;
+    if (nd == ns) d[nd - 1] += s[nd - 1];
+
+    for (int i = 0; i < nd; ++i) {
+        x[2 * i] = s[i];
+        x[2 * i + 1] = d[i];
+    }
+    if (ns > nd) x[n - 1] = s[ns - 1];
+}
+
+// Same lifting steps as the row version, applied to w columns at once:
+// every s/d entry is a row of w samples in the strip buffer.
+static void lift_columns_forward(int32_t* col, int stride, int n, int w, int32_t* tmp) {
+    const int ns = (n + 1) / 2;
+    const int nd = n / 2;
+    auto s = [&](int i) { return tmp + static_cast<size_t>(i) * w; };
+    auto d = [&](int i) { return tmp + static_cast<size_t>(ns + i) * w; };
+
+    for (int r = 0; r < n; ++r) {
+        int32_t* dst = (r % 2 == 0) ? s(r / 2) : d(r / 2);
+        std::memcpy(dst, col + static_cast<size_t>(r) * stride, sizeof(int32_t) * w);
+    }
+
+    for (int i = 0; i < ns - 1; ++i) {
+        int32_t* di = d(i);
+        const int32_t* s0 = s(i);
+        const int32_t* s1 = s(i + 1);
+        for (int c = 0; c < w; ++c) di[c] -= (s0[c] + s1[c]) >> 1;
+    }
+    if (nd == ns) {
+        int32_t* di = d(nd - 1);
+        const int32_t* s0 = s(nd - 1);
+        for (int c = 0; c < w; ++c) di[c] -= s0[c];
+    }
+
+    for (int i = 0; i < ns; ++i) {
+        int32_t* si = s(i);
+        const int32_t* d0 = d(i > 0 ? i - 1 : 0);
+        const int32_t* d1 = d(i < nd ? i : nd - 1);
+        for (int c = 0; c < w; ++c) si[c] += (d0[c] + d1[c] + 2) >> 2;
+    }
+
+    for (int r = 0; r < n; ++r) {
+        std::memcpy(col + static_cast<size_t>(r) * stride, tmp + static_cast<size_t>(r) * w, sizeof(int32_t) * w);
+    }
+}
+
+static void lift_columns_inverse(int32_t* col, int stride, int n, int w, int32_t* tmp) {
+    const int ns = (n + 1) / 2;
+    const int nd = n / 2;
+    auto s = [&](int i) { return tmp + static_cast<size_t>(i) * w; };
+    auto d = [&](int i) { return tmp + static_cast<size_t>(ns + i) * w; };
+
+    for (int r = 0; r < n; ++r) {
+        std::memcpy(tmp + static_cast<size_t>(r) * w, col + static_cast<size_t>(r) * stride, sizeof(int32_t) * w);
+    }
+
+    for (int i = 0; i < ns; ++i) {
+        int32_t* si = s(i);
+        const int32_t* d0 = d(i > 0 ? i - 1 : 0);
+        const int32_t* d1 = d(i < nd ? i : nd - 1);
+        for (int c = 0; c < w; ++c) si[c] -= (d0[c] + d1[c] + 2) >> 2;
+    }
+
+    for (int i = 0; i < ns - 1; ++i) {
+        int32_t* di = d(i);
+        const int32_t* s0 = s(i);
+        const int32_t* s1 = s(i + 1);
+        for (int c = 0; c < w; ++c) di[c] += (s0[c] + s1[c]) >> 1;
+    }
+    if (nd == ns) {
+        int32_t* di = d(nd - 1);
+        const int32_t* s0 = s(nd - 1);
+        for (int c = 0; c < w; ++c) di[c] += s0[c];
+    }
+
+    for (int r = 0; r < n; ++r) {
+        const int32_t* src = (r % 2 == 0) ? s(r / 2) : d(r / 2);
+        std::memcpy(col + static_cast<size_t>(r) * stride, src, sizeof(int32_t) * w);
+    }
+}
+
+void dwt53_forward(int32_t* plane, int rows, int cols, int levels) {
+    std::vector<int32_t> tmp(std::max(static_cast<size_t>(cols), static_cast<size_t>(rows) * COLUMN_STRIP));
+
+    for (int l = 0; l < levels; ++l) {
+        const int h = wavelet_size(rows, l);
+        const int w = wavelet_size(cols, l);
+        if (w >= 2) {
+            for (int r = 0; r < h; ++r) {
+                lift_row_forward(plane + static_cast<size_t>(r) * cols, w, tmp.data());
+            }
+        }
+        if (h >= 2) {
+            for (int c0 = 0; c0 < w; c0 += COLUMN_STRIP) {
+                lift_columns_forward(plane + c0, cols, h, std::min(COLUMN_STRIP, w - c0), tmp.data());
+            }
+        }
+    }
+}
+
+void dwt53_inverse(int32_t* plane, int rows, int cols, int levels, int first_level) {
+    std::vector<int32_t> tmp(std::max(static_cast<size_t>(cols), static_cast<size_t>(rows) * COLUMN_STRIP));
+
+    for (int l = levels - 1; l >= first_level; --l) {
+        const int h = wavelet_size(rows, l);
+        const int w = wavelet_size(cols, l);
+        if (h >= 2) {
+            for (int c0 = 0; c0 < w; c0 += COLUMN_STRIP) {
+                lift_columns_inverse(plane + c0, cols, h, std::min(COLUMN_STRIP, w - c0), tmp.data());
+            }
+        }
+        if (w >= 2) {
+            for (int r = 0; r < h; ++r) {
+                lift_row_inverse(plane + static_cast<size_t>(r) * cols, w, tmp.data());
+            }
+        }
+    }
+}
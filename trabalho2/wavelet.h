@@ -0,0 +1,27 @@
+#ifndef WAVELET_H
+#define WAVELET_H
+
+#include <cstdint>
+
+// Reversible CDF 5/3 wavelet (the JPEG 2000 lossless filter) computed with
+// integer lifting and symmetric extension at the borders:
+//
+//   d[i] = x[2i+1] - floor((x[2i] + x[2i+2]) / 2)
+//   s[i] = x[2i]   + floor((d[i-1] + d[i] + 2) / 4)
+//
+// The plane is transformed in place in the usual Mallat layout: after each
+// level the low-pass half sits at the top-left and is split again, so the
+// LL band of level l covers wavelet_size(rows, l) x wavelet_size(cols, l).
+
+// Length of the low-pass part of a signal of length n after 'level' splits.
+inline int wavelet_size(int n, int level) {
+    return (n + (1 << level) - 1) >> level;
+}
+
+void dwt53_forward(int32_t* plane, int rows, int cols, int levels);
+
+// Undoes levels 'levels' down to 'first_level' + 1, leaving the LL band of
+// first_level reconstructed (first_level = 0 gives back the whole plane).
+void dwt53_inverse(int32_t* plane, int rows, int cols, int levels, int first_level = 0);
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef WEIGHTED_PREDICTOR_H
+#define WEIGHTED_PREDICTOR_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+// Self-correcting weighted predictor, after the one in JPEG XL: several
+// simple sub-predictors are blended with weights that fall with the errors
+// each of them made on the causal neighbours (W, NW, N, NE). Everything is
+// integer; the weights come from a reciprocal table, so the only division
+// per pixel is the final normalization.
+//
+// Use: start_row(r) once per row, then for every pixel predict() followed
+// by update() with the sample that the decoder will see.
+class WeightedPredictor {
+public:
+    static const int NUM_SUB = 5;  // W, N, NW, NE, W + N - NW
+
+    WeightedPredictor(int cols, int maxval)
+        : m_cols(cols), m_maxval(maxval), m_errors(2 * NUM_SUB * static_cast<size_t>(cols + 2), 0),
+          m_above(NUM_SUB * static_cast<size_t>(cols), 0) {
+        // Errors are measured on an 8-bit scale whatever the sample depth.
+        while ((maxval >> m_error_shift) > 255) m_error_shift++;
+        for (int e = 0; e < ERROR_TABLE; ++e) {
+            m_weight[e] = static_cast<uint32_t>((1u << 24) / ((e + 1) * (e + 1)));
+        }
+    }
+
+    void start_row(int r) {
+        m_cur = m_errors.data() + static_cast<size_t>(r % 2) * NUM_SUB * (m_cols + 2);
+        const int* prev = m_errors.data() + static_cast<size_t>((r + 1) % 2) * NUM_SUB * (m_cols + 2);
+        m_first_row = (r == 0);
+
+        // The NW + N + NE part of every error sum in the row, in one pass.
+        const size_t n = NUM_SUB * static_cast<size_t>(m_cols);
+        for (size_t k = 0; k < n; ++k) {
+            m_above[k] = prev[k] + prev[k + NUM_SUB] + prev[k + 2 * NUM_SUB];
+        }
+    }
+
+    // Neighbours outside the image must already be replaced by the caller
+    // (see predict_at); this is the branch-free interior path.
+    int predict(int c, int w, int n, int nw, int ne) {
+        m_sub[0] = w;
+        m_sub[1] = n;
+        m_sub[2] = nw;
+        m_sub[3] = ne;
+        m_sub[4] = std::clamp(w + n - nw, 0, m_maxval);
+
+        const int* west = m_cur + static_cast<size_t>(c) * NUM_SUB;
+        const int* above = m_above.data() + static_cast<size_t>(c) * NUM_SUB;
+        int64_t num = 0;
+        int64_t den = 0;
+        for (int i = 0; i < NUM_SUB; ++i) {
+            int e = (west[i] + above[i]) >> m_error_shift;
+            int64_t weight = m_weight[std::min(e, ERROR_TABLE - 1)];
+            num += weight * m_sub[i];
+            den += weight;
+        }
+        int p = static_cast<int>((num + den / 2) / den);
+
+        // As in JPEG XL, stay within the range of the nearest neighbours.
+        int lo = std::min(w, std::min(n, ne));
+        int hi = std::max(w, std::max(n, ne));
+        return std::clamp(p, lo, hi);
+    }
+
+    // General path for any position: missing neighbours are replaced by
+    // the nearest available ones.
+    template <typename T>
+    int predict_at(const T* row, const T* up, int c) {
+        if (m_first_row) {
+            int w = (c > 0) ? row[c - 1] : 0;
+            return predict(c, w, w, w, w);
+        }
+        int n = up[c];
+        int w = (c > 0) ? row[c - 1] : n;
+        int nw = (c > 0) ? up[c - 1] : n;
+        int ne = (c + 1 < m_cols) ? up[c + 1] : n;
+        return predict(c, w, n, nw, ne);
+    }
+
+    void update(int c, int x) {
+        int* err = m_cur + static_cast<size_t>(c + 1) * NUM_SUB;
+        for (int i = 0; i < NUM_SUB; ++i) {
+            err[i] = std::abs(m_sub[i] - x);
+        }
+    }
+
+private:
+    static const int ERROR_TABLE = 1024;
+
+    int m_cols;
+    int m_maxval;
+    int m_error_shift = 0;
+    bool m_first_row = true;
+    // Two rows of errors, padded by one pixel on each side, with the
+    // NUM_SUB errors of a pixel next to each other.
+    std::vector<int> m_errors;
+    std::vector<int> m_above;  // per pixel and sub-predictor: NW + N + NE errors
+    int* m_cur = nullptr;
+    std::array<int, NUM_SUB> m_sub{};
+    std::array<uint32_t, ERROR_TABLE> m_weight{};
+};
+
+#endif